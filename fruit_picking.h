@@ -2,26 +2,110 @@
 #define FRUIT_PICKING_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <compare>
-#include <deque>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <queue>
 #include <ranges>
+#include <span>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "fruit_picking_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRUIT_PICKING_X86 1
+#endif
+
 constexpr const char* DEFAULT_PICKER_NAME = "Anonim";
 
-enum class Taste { SWEET, SOUR };
+enum class Taste : std::uint8_t { SWEET, SOUR };
+
+enum class Size : std::uint8_t { LARGE, MEDIUM, SMALL };
+
+enum class Quality : std::uint8_t { HEALTHY, ROTTEN, WORMY };
+
+// One-byte encoding of a fruit: bits 0-1 hold the quality, bits 2-3 the size
+// and bit 4 the taste. Only 18 of the 32 representable values are valid.
+class FruitCode {
+   public:
+    using value_type = std::uint8_t;
+
+    static constexpr value_type QUALITY_MASK = 0b00011;
+    static constexpr value_type SIZE_MASK = 0b01100;
+    static constexpr value_type TASTE_MASK = 0b10000;
+
+    static constexpr int SIZE_SHIFT = 2;
+    static constexpr int TASTE_SHIFT = 4;
+
+    // Number of representable values, valid or not.
+    static constexpr std::size_t VALUE_COUNT = std::size_t(1) << 5;
+
+    static constexpr FruitCode encode(Taste taste, Size size, Quality quality);
+    // Does not validate; `value` must come from FruitCode::value().
+    static constexpr FruitCode from_value(value_type value) {
+        return FruitCode{value};
+    }
+    // The code with this value, or nothing for the values no fruit has:
+    // those out of range or with the unused size or quality 3.
+    static constexpr std::optional<FruitCode> try_from_value(
+        std::size_t value) {
+        if (value >= VALUE_COUNT || (value & QUALITY_MASK) == QUALITY_MASK ||
+            (value & SIZE_MASK) == SIZE_MASK) {
+            return std::nullopt;
+        }
+        return FruitCode{static_cast<value_type>(value)};
+    }
+
+    constexpr std::tuple<Taste, Size, Quality> decode() const {
+        return {taste(), size(), quality()};
+    }
+    constexpr Taste taste() const {
+        return static_cast<Taste>((bits & TASTE_MASK) >> TASTE_SHIFT);
+    }
+    constexpr Size size() const {
+        return static_cast<Size>((bits & SIZE_MASK) >> SIZE_SHIFT);
+    }
+    constexpr Quality quality() const {
+        return static_cast<Quality>(bits & QUALITY_MASK);
+    }
+    constexpr FruitCode with_quality(Quality quality) const {
+        return FruitCode(static_cast<value_type>(
+            (bits & ~QUALITY_MASK) | static_cast<value_type>(quality)));
+    }
+    constexpr value_type value() const { return bits; }
+    constexpr bool operator==(const FruitCode& other) const = default;
 
-enum class Size { LARGE, MEDIUM, SMALL };
+   private:
+    explicit constexpr FruitCode(value_type value) : bits(value) {}
 
-enum class Quality { HEALTHY, ROTTEN, WORMY };
+    value_type bits;
+};
 
 class Fruit {
    public:
     explicit constexpr Fruit(Taste taste, Size size, Quality quality);
+    explicit constexpr Fruit(FruitCode code) : fruit_code(code) {}
     constexpr Fruit(const Fruit& other) = default;
     explicit constexpr Fruit(std::tuple<Taste, Size, Quality>);
     constexpr Fruit& operator=(const Fruit&) = default;
@@ -29,9 +113,10 @@ class Fruit {
     constexpr Fruit(Fruit&&) = default;
     void go_rotten();
     void become_worm_infested();
-    constexpr Taste taste() const { return fruit_taste; }
-    constexpr Size size() const { return fruit_size; }
-    constexpr Quality quality() const { return fruit_quality; }
+    constexpr Taste taste() const { return fruit_code.taste(); }
+    constexpr Size size() const { return fruit_code.size(); }
+    constexpr Quality quality() const { return fruit_code.quality(); }
+    constexpr FruitCode code() const { return fruit_code; }
     constexpr bool operator==(const Fruit& other) const = default;
     constexpr explicit operator std::tuple<Taste, Size, Quality>() const {
         return {taste(), size(), quality()};
@@ -39,67 +124,650 @@ class Fruit {
     friend std::ostream& operator<<(std::ostream& os, const Fruit& fruit);
 
    private:
-    Taste fruit_taste;
-    Size fruit_size;
-    Quality fruit_quality;
+    FruitCode fruit_code;
+};
+
+static_assert(sizeof(Fruit) == 1 && std::is_trivially_copyable_v<Fruit>);
+
+// Contiguous fruit history with amortised O(1) push_back and pop_front.
+// Popping only advances `head`; the dead prefix is reclaimed by sliding the
+// live fruits down once it is at least as long as the live range, so the
+// fruits always form a single span. Up to INLINE_CAPACITY fruits live in
+// the log itself; longer histories spill to a heap block, which copies
+// share until one of them writes, so copying a log is O(1).
+//
+// Storage comes from the log's memory resource. Plain copies keep the
+// source's resource and share its storage; a copy into another resource,
+// or an assignment between logs of different resources, copies the fruits.
+class FruitLog {
+   public:
+    using size_type = std::size_t;
+    using const_iterator = const Fruit*;
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    static constexpr size_type npos = size_type(-1);
+    static constexpr size_type INLINE_CAPACITY = 16;
+
+    FruitLog() = default;
+    explicit FruitLog(const allocator_type& allocator)
+        : allocator(allocator) {}
+    FruitLog(const FruitLog& other);
+    FruitLog(const FruitLog& other, const allocator_type& allocator);
+    FruitLog(FruitLog&& other) noexcept;
+    FruitLog(FruitLog&& other, const allocator_type& allocator);
+    FruitLog& operator=(const FruitLog& other);
+    FruitLog& operator=(FruitLog&& other);
+    ~FruitLog();
+
+    allocator_type get_allocator() const { return allocator; }
+
+    size_type size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+
+    const Fruit& operator[](size_type index) const { return data()[index]; }
+    const Fruit& front() const { return data()[0]; }
+    const Fruit& back() const { return data()[size() - 1]; }
+
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size(); }
+
+    std::span<const Fruit> fruits() const { return {begin(), end()}; }
+    // Writable view of the fruits; unshares the storage first.
+    std::span<Fruit> mutable_fruits();
+
+    // Whether the storage is currently shared with another copy.
+    bool is_shared() const;
+
+    void reserve(size_type count);
+    void push_back(const Fruit& fruit);
+    // Copies the fruits in as they are, with no quality rules applied.
+    void append(std::span<const Fruit> fruits);
+    void pop_front(size_type count = 1);
+
+   private:
+    // Heap storage shared by copies of a log; the fruits follow the header.
+    // Readers never copy it, writers first make it exclusive.
+    struct Block {
+        std::atomic<std::size_t> references;
+        size_type capacity;
+
+        Fruit* fruits() { return reinterpret_cast<Fruit*>(this + 1); }
+    };
+
+    allocator_type allocator;
+    Block* block = nullptr;  // null while the fruits are inline
+    size_type head = 0;
+    size_type tail = 0;
+    alignas(Fruit) std::byte inline_bytes[INLINE_CAPACITY] = {};
+
+    Fruit* storage() {
+        return block ? block->fruits()
+                     : reinterpret_cast<Fruit*>(inline_bytes);
+    }
+    const Fruit* storage() const {
+        return block ? block->fruits()
+                     : reinterpret_cast<const Fruit*>(inline_bytes);
+    }
+    const Fruit* data() const { return storage() + head; }
+    size_type capacity() const {
+        return block ? block->capacity : INLINE_CAPACITY;
+    }
+
+    Block* allocate_block(size_type capacity);
+    void release();
+    void reallocate(size_type new_capacity);
+    void make_room(size_type extra);
+    void grow(size_type extra);
+};
+
+// Joint histogram of fruits over (taste, size, quality): one count per
+// valid combination, 18 in all. A count() with attributes left out sums the
+// buckets they cover, at most all 18.
+class FruitHistogram {
+   public:
+    // Per-code change applied in one go; entries may be negative.
+    using Delta = std::array<std::ptrdiff_t, FruitCode::VALUE_COUNT>;
+
+    std::size_t count(std::optional<Taste> taste = std::nullopt,
+                      std::optional<Size> size = std::nullopt,
+                      std::optional<Quality> quality = std::nullopt) const;
+
+    void add(FruitCode code, std::size_t n = 1);
+    void remove(FruitCode code, std::size_t n = 1);
+    void move(FruitCode from, FruitCode to, std::size_t n = 1);
+    void apply(const Delta& delta);
+
+    bool operator==(const FruitHistogram& other) const = default;
+
+   private:
+    static constexpr std::size_t TASTES = 2;
+    static constexpr std::size_t SIZES = 3;
+    static constexpr std::size_t QUALITIES = 3;
+    static constexpr std::size_t BUCKET_COUNT = TASTES * SIZES * QUALITIES;
+
+    static constexpr std::size_t bucket(std::size_t taste, std::size_t size,
+                                        std::size_t quality) {
+        return (taste * SIZES + size) * QUALITIES + quality;
+    }
+    static constexpr std::size_t bucket_of(FruitCode code) {
+        return bucket(static_cast<std::size_t>(code.taste()),
+                      static_cast<std::size_t>(code.size()),
+                      static_cast<std::size_t>(code.quality()));
+    }
+
+    std::array<std::size_t, BUCKET_COUNT> buckets{};
+};
+
+// A picker's ranking criteria kept next to each other, so comparing two
+// pickers is usually one integer compare instead of six count lookups. Most
+// significant first: healthy, sweet, large, medium and small fruits, each a
+// full 64-bit count. The final criterion, the total count, needs no field:
+// with equal large and medium counts it orders exactly like the small count.
+// Keys are kept up to date by adding and removing the contribution of single
+// fruits.
+class RankKey {
+   public:
+    static constexpr std::size_t FIELDS = 5;
+    using Counts = std::array<std::uint64_t, FIELDS>;
+
+    // Ascending by counts; the best picker has the greatest key.
+    constexpr std::strong_ordering operator<=>(const RankKey& other) const;
+    constexpr bool operator==(const RankKey&) const = default;
+
+    constexpr void add(FruitCode code, std::uint64_t n = 1);
+    constexpr void remove(FruitCode code, std::uint64_t n = 1);
+
+    // Most significant first.
+    constexpr Counts counts() const {
+        return {high(primary), low(primary), high(secondary), low(secondary),
+                tertiary};
+    }
+
+   private:
+    // Two counts side by side, so one compare covers both.
+    __extension__ using Pair = unsigned __int128;
+
+    Pair primary = 0;    // healthy << 64 | sweet
+    Pair secondary = 0;  // large << 64 | medium
+    std::uint64_t tertiary = 0;  // small
+
+    static constexpr std::uint64_t high(Pair pair) {
+        return static_cast<std::uint64_t>(pair >> 64);
+    }
+    static constexpr std::uint64_t low(Pair pair) {
+        return static_cast<std::uint64_t>(pair);
+    }
+
+    static constexpr RankKey contribution(FruitCode code);
+};
+
+// Rolling polynomial hash of a fruit sequence: the sum of (code + 1) * BASE^i
+// over the positions i counted from the front, modulo 2^64. Appends, pops
+// from the front and in-place changes each update it in O(1), so a picker's
+// content can be fingerprinted without rescanning its history.
+class FruitFingerprint {
+   public:
+    // weight(i + 1) == weight(i) * BASE
+    static constexpr std::uint64_t BASE = 0x100000001b3ULL;
+
+    // Rebuilds the fingerprint of `size` fruits from a saved value().
+    static constexpr FruitFingerprint from_value(std::uint64_t value,
+                                                 std::size_t size);
+
+    constexpr std::uint64_t value() const { return hash; }
+
+    constexpr void push_back(FruitCode code);
+    constexpr void pop_front(FruitCode code);
+    // Pops all of `fruits`, the current front segment, at once.
+    constexpr void pop_front(std::span<const Fruit> fruits);
+
+    // Weight of the fruit at `position`, or `distance` places from the back
+    // (1 is the last fruit), to be passed to replace().
+    constexpr std::uint64_t weight(std::size_t position) const;
+    constexpr std::uint64_t weight_from_back(std::size_t distance) const;
+    // A fruit of the given weight changed from `from` to `to`. The update is
+    // linear, so the same change at several positions may pass the sum of
+    // their weights.
+    constexpr void replace(std::uint64_t weight, FruitCode from, FruitCode to);
+
+    constexpr bool operator==(const FruitFingerprint&) const = default;
+
+   private:
+    static constexpr std::uint64_t BASE_INVERSE = [] {
+        // Newton's iteration doubles the correct low bits each step.
+        std::uint64_t inverse = BASE;
+        for (int i = 0; i < 5; ++i) inverse *= 2 - BASE * inverse;
+        return inverse;
+    }();
+    static_assert(BASE * BASE_INVERSE == 1);
+
+    static constexpr std::uint64_t power(std::uint64_t base,
+                                         std::size_t exponent);
+
+    std::uint64_t hash = 0;
+    std::uint64_t next_weight = 1;  // BASE^size
 };
 
+// Kernels for the worm sweep: every SWEET and HEALTHY fruit in the range
+// becomes WORMY and the number of converted fruits of each Size is returned.
+// The vector variants work on the packed FruitCode bytes, 16 or 32 at a time.
+namespace fruit_kernels {
+
+static_assert(static_cast<int>(Taste::SWEET) == 0 &&
+                  static_cast<int>(Quality::HEALTHY) == 0,
+              "kernels select SWEET+HEALTHY fruits as all-zero bits");
+
+// A fruit is SWEET and HEALTHY iff these bits are all zero.
+constexpr FruitCode::value_type SWEET_HEALTHY_BITS =
+    FruitCode::TASTE_MASK | FruitCode::QUALITY_MASK;
+
+// Converted fruits indexed by Size.
+using SizeCounts = std::array<std::size_t, 3>;
+
+constexpr FruitCode::value_type size_bits(Size size) {
+    return static_cast<FruitCode::value_type>(static_cast<int>(size)
+                                              << FruitCode::SIZE_SHIFT);
+}
+
+inline SizeCounts& operator+=(SizeCounts& lhs, const SizeCounts& rhs) {
+    for (std::size_t i = 0; i < lhs.size(); ++i) lhs[i] += rhs[i];
+    return lhs;
+}
+
+inline SizeCounts infect_sweet_healthy_scalar(Fruit* first,
+                                              std::size_t count) {
+    SizeCounts converted{};
+    for (std::size_t i = 0; i < count; ++i) {
+        if ((first[i].code().value() & SWEET_HEALTHY_BITS) == 0) {
+            first[i].become_worm_infested();
+            ++converted[static_cast<std::size_t>(first[i].size())];
+        }
+    }
+    return converted;
+}
+
+// Splits the popcount of `hit` over sizes; SMALL is whatever is left.
+inline void count_by_size(SizeCounts& converted, unsigned hit, unsigned large,
+                          unsigned medium) {
+    const auto total = static_cast<std::size_t>(std::popcount(hit));
+    const auto l = static_cast<std::size_t>(std::popcount(hit & large));
+    const auto m = static_cast<std::size_t>(std::popcount(hit & medium));
+    converted[static_cast<std::size_t>(Size::LARGE)] += l;
+    converted[static_cast<std::size_t>(Size::MEDIUM)] += m;
+    converted[static_cast<std::size_t>(Size::SMALL)] += total - l - m;
+}
+
+#ifdef FRUIT_PICKING_X86
+
+// Adds the byte lanes of `lanes` to `total`.
+inline void add_lane_sum(std::size_t& total, __m128i lanes) {
+    __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+    total += static_cast<std::size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<std::size_t>(_mm_extract_epi16(sums, 4));
+}
+
+// Baseline x86-64 does not guarantee POPCNT, so this variant counts hits in
+// per-byte lane counters and folds them into `converted` before they wrap.
+inline SizeCounts infect_sweet_healthy_sse2(Fruit* first, std::size_t count) {
+    const __m128i select = _mm_set1_epi8(SWEET_HEALTHY_BITS);
+    const __m128i sizes = _mm_set1_epi8(FruitCode::SIZE_MASK);
+    const __m128i large = _mm_set1_epi8(size_bits(Size::LARGE));
+    const __m128i medium = _mm_set1_epi8(size_bits(Size::MEDIUM));
+    const __m128i wormy = _mm_set1_epi8(static_cast<char>(Quality::WORMY));
+    const __m128i zero = _mm_setzero_si128();
+
+    SizeCounts converted{};
+    std::size_t hits = 0;
+    __m128i hit_lanes = zero, large_lanes = zero, medium_lanes = zero;
+    unsigned pending = 0;
+
+    auto flush = [&] {
+        std::size_t l = 0, m = 0;
+        add_lane_sum(hits, hit_lanes);
+        add_lane_sum(l, large_lanes);
+        add_lane_sum(m, medium_lanes);
+        converted[static_cast<std::size_t>(Size::LARGE)] += l;
+        converted[static_cast<std::size_t>(Size::MEDIUM)] += m;
+        hits -= l + m;
+        hit_lanes = large_lanes = medium_lanes = zero;
+        pending = 0;
+    };
+
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto* lane = reinterpret_cast<__m128i*>(first + i);
+        __m128i bytes = _mm_loadu_si128(lane);
+        __m128i hit = _mm_cmpeq_epi8(_mm_and_si128(bytes, select), zero);
+        if (_mm_movemask_epi8(hit) == 0) continue;
+
+        // SSE2 has no blendv: (hit & infected) | (~hit & bytes).
+        __m128i infected = _mm_or_si128(bytes, wormy);
+        __m128i size = _mm_and_si128(bytes, sizes);
+        bytes = _mm_or_si128(_mm_and_si128(hit, infected),
+                             _mm_andnot_si128(hit, bytes));
+        _mm_storeu_si128(lane, bytes);
+
+        // Hit lanes are all ones, i.e. -1, so subtracting counts them.
+        hit_lanes = _mm_sub_epi8(hit_lanes, hit);
+        large_lanes = _mm_sub_epi8(
+            large_lanes, _mm_and_si128(hit, _mm_cmpeq_epi8(size, large)));
+        medium_lanes = _mm_sub_epi8(
+            medium_lanes, _mm_and_si128(hit, _mm_cmpeq_epi8(size, medium)));
+        if (++pending == 255) flush();
+    }
+    flush();
+    converted[static_cast<std::size_t>(Size::SMALL)] += hits;
+    converted += infect_sweet_healthy_scalar(first + i, count - i);
+    return converted;
+}
+
+__attribute__((target("avx2,popcnt"))) inline SizeCounts
+infect_sweet_healthy_avx2(Fruit* first, std::size_t count) {
+    const __m256i select = _mm256_set1_epi8(SWEET_HEALTHY_BITS);
+    const __m256i sizes = _mm256_set1_epi8(FruitCode::SIZE_MASK);
+    const __m256i large = _mm256_set1_epi8(size_bits(Size::LARGE));
+    const __m256i medium = _mm256_set1_epi8(size_bits(Size::MEDIUM));
+    const __m256i wormy = _mm256_set1_epi8(static_cast<char>(Quality::WORMY));
+    const __m256i zero = _mm256_setzero_si256();
+
+    SizeCounts converted{};
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto* lane = reinterpret_cast<__m256i*>(first + i);
+        __m256i bytes = _mm256_loadu_si256(lane);
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), zero);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+        if (mask == 0) continue;
+
+        __m256i size = _mm256_and_si256(bytes, sizes);
+        bytes = _mm256_blendv_epi8(bytes, _mm256_or_si256(bytes, wormy), hit);
+        _mm256_storeu_si256(lane, bytes);
+        count_by_size(converted, mask,
+                      static_cast<unsigned>(_mm256_movemask_epi8(
+                          _mm256_cmpeq_epi8(size, large))),
+                      static_cast<unsigned>(_mm256_movemask_epi8(
+                          _mm256_cmpeq_epi8(size, medium))));
+    }
+    converted += infect_sweet_healthy_sse2(first + i, count - i);
+    return converted;
+}
+
+inline bool avx2_supported() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif  // FRUIT_PICKING_X86
+
+using InfectKernel = SizeCounts (*)(Fruit*, std::size_t);
+
+// Picks the widest kernel the running CPU supports; decided once.
+inline InfectKernel select_infect_kernel() {
+#ifdef FRUIT_PICKING_X86
+    return avx2_supported() ? infect_sweet_healthy_avx2
+                            : infect_sweet_healthy_sse2;
+#else
+    return infect_sweet_healthy_scalar;
+#endif
+}
+
+inline SizeCounts infect_sweet_healthy(std::span<Fruit> fruits) {
+    // Short ranges are not worth an indirect call.
+    if (fruits.size() < 16) {
+        return infect_sweet_healthy_scalar(fruits.data(), fruits.size());
+    }
+    static const InfectKernel kernel = select_infect_kernel();
+    return kernel(fruits.data(), fruits.size());
+}
+
+// Summed FruitFingerprint weight of the fruits the worm sweep would convert,
+// given the weight of the first fruit. Eight fruits are tested at once as a
+// word; the word's hit pattern, gathered into a byte, indexes a table of
+// the relative weights it sums to.
+inline std::uint64_t sweet_healthy_weight(std::span<const Fruit> fruits,
+                                          std::uint64_t weight) {
+    constexpr std::uint64_t base8 = [] {
+        std::uint64_t p = 1;
+        for (int k = 0; k < 8; ++k) p *= FruitFingerprint::BASE;
+        return p;
+    }();
+    constexpr auto pattern_weights = [] {
+        std::array<std::uint64_t, 256> table{};
+        for (std::size_t pattern = 0; pattern < table.size(); ++pattern) {
+            std::uint64_t power = 1;
+            for (std::size_t k = 0; k < 8; ++k) {
+                if (pattern >> k & 1) table[pattern] += power;
+                power *= FruitFingerprint::BASE;
+            }
+        }
+        return table;
+    }();
+    constexpr std::uint64_t ones = 0x0101010101010101ULL;
+    constexpr std::uint64_t high = ones * 0x80;
+
+    std::uint64_t total = 0;
+    std::size_t i = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        for (; i + 8 <= fruits.size(); i += 8, weight *= base8) {
+            std::uint64_t word;
+            std::memcpy(&word, fruits.data() + i, sizeof(word));
+            // Masked bytes are at most 0x13, so adding 0x7f sets the high
+            // bit of exactly the non-zero ones and never carries over.
+            const std::uint64_t masked = word & (ones * SWEET_HEALTHY_BITS);
+            const std::uint64_t hits = ~(masked + ones * 0x7f) & high;
+            // Moves the high bit of byte k to bit 56 + k.
+            const auto pattern = static_cast<std::size_t>(
+                ((hits >> 7) * 0x0102040810204080ULL) >> 56);
+            total += weight * pattern_weights[pattern];
+        }
+    }
+    for (; i < fruits.size(); ++i, weight *= FruitFingerprint::BASE) {
+        if ((fruits[i].code().value() & SWEET_HEALTHY_BITS) == 0) {
+            total += weight;
+        }
+    }
+    return total;
+}
+
+}  // namespace fruit_kernels
+
+// The name and the fruit history are allocated from the picker's memory
+// resource. Copies keep the source's resource unless given another, and
+// assignment keeps the target's, so a picker built in an arena stays there.
 class Picker {
    public:
-    Picker(std::string_view = DEFAULT_PICKER_NAME);
-    const std::string& get_name() const { return picker_name; }
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    Picker(std::string_view name = DEFAULT_PICKER_NAME,
+           const allocator_type& allocator = {});
+    explicit Picker(const allocator_type& allocator)
+        : Picker(DEFAULT_PICKER_NAME, allocator) {}
+    Picker(const Picker& other) : Picker(other, other.get_allocator()) {}
+    Picker(const Picker& other, const allocator_type& allocator);
+    Picker(Picker&& other) noexcept = default;
+    Picker(Picker&& other, const allocator_type& allocator);
+    Picker& operator=(const Picker& other) = default;
+    Picker& operator=(Picker&& other) = default;
+
+    allocator_type get_allocator() const {
+        return collected_fruits.get_allocator();
+    }
+
+    // A picker whose history is exactly `fruits`, e.g. as printed by
+    // operator<<. No rules are applied, so the fruits should be a history
+    // the rules can produce.
+    static Picker from_history(std::string_view name,
+                               std::span<const Fruit> fruits,
+                               const allocator_type& allocator = {});
+    std::string_view get_name() const { return picker_name; }
     std::size_t count_fruits() const { return collected_fruits.size(); }
+    // The fruit history, oldest first.
+    std::span<const Fruit> fruits() const { return collected_fruits.fruits(); }
     std::size_t count_taste(Taste taste) const;
     std::size_t count_size(Size size) const;
     std::size_t count_quality(Quality quality) const;
+    // Fruits matching all given attributes; a missing one matches anything.
+    std::size_t count(std::optional<Taste> taste = std::nullopt,
+                      std::optional<Size> size = std::nullopt,
+                      std::optional<Quality> quality = std::nullopt) const {
+        return histogram.count(taste, size, quality);
+    }
 
     Picker& operator+=(const Fruit& fruit);
 
+    // Same final state as adding the fruits one by one with operator+=, but
+    // done in one pass with a single reservation and counter update.
+    Picker& add_range(std::span<const Fruit> fruits);
+    template <std::ranges::input_range R>
+        requires std::convertible_to<std::ranges::range_reference_t<R>,
+                                     Fruit> &&
+                 (!std::convertible_to<R, std::span<const Fruit>>)
+    Picker& add_range(R&& fruits);
+
     Picker& operator+=(Picker& other);
     Picker& operator+=(Picker&& other);
 
     Picker& operator-=(Picker& other);
     Picker& operator-=(Picker&& other);
 
+    // Same result as n single-fruit steals (operator+=) or gives
+    // (operator-=), or as many as there are fruits, done as one segment
+    // move: the giver's counters drop by one histogram delta and the
+    // receiver applies the rot and worm rules in a single fused pass.
+    Picker& steal_n(Picker& other, std::size_t n);
+    Picker& give_n(Picker& other, std::size_t n);
+    Picker& steal_all(Picker& other) {
+        return steal_n(other, other.count_fruits());
+    }
+    Picker& give_all(Picker& other) { return give_n(other, count_fruits()); }
+
     bool operator==(const Picker& other) const;
-    auto operator<=>(const Picker& other) const;
+    std::strong_ordering operator<=>(const Picker& other) const {
+        return other.ranking_key <=> ranking_key;
+    }
+    const RankKey& rank_key() const { return ranking_key; }
+    // Hash of the name and the fruit history; equal pickers have equal
+    // fingerprints.
+    std::uint64_t fingerprint() const;
     friend std::ostream& operator<<(std::ostream& os, const Picker& picker);
 
    private:
-    std::string picker_name;
-    std::deque<Fruit> collected_fruits;
-
-    std::size_t healthy_count = 0;
-    std::size_t wormy_count = 0;
-    std::size_t rotten_count = 0;
-
-    std::size_t sweet_count = 0;
-    std::size_t sour_count = 0;
+    RankKey ranking_key;  // first, where its alignment costs no padding
+    std::pmr::string picker_name;
+    FruitLog collected_fruits;
 
-    std::size_t large_count = 0;
-    std::size_t medium_count = 0;
-    std::size_t small_count = 0;
+    FruitHistogram histogram;
+    FruitFingerprint content_fingerprint;
 
-    std::deque<Fruit>::size_type last_wormy_index =
-        std::deque<Fruit>::size_type(-1);
+    FruitLog::size_type last_wormy_index = FruitLog::npos;
     void adjust_index_after_pop_front();
     void handle_rot_between_last_two();
     void handle_worm_infection();
 
-    void decrement_counters_for(const Fruit& f);
+    template <class It, class Sentinel>
+    void append_fused(It first, Sentinel last);
+
+    // Keep `histogram` and `ranking_key` in step.
+    void count_in(FruitCode code, std::size_t n = 1);
+    void count_out(FruitCode code, std::size_t n = 1);
+    void recount(FruitCode from, FruitCode to, std::size_t n = 1);
+    void apply_delta(const FruitHistogram::Delta& delta);
+    void infect_up_to(FruitLog::size_type wormy_index);
+    void record_infected(const fruit_kernels::SizeCounts& converted,
+                         std::uint64_t weight);
+    Fruit take_front();
+    void drop_front(std::size_t n);
+
+    friend class Snapshot;
+};
+
+// Tournament over k sorted sources that keeps the loser of every match, so
+// after the winner's source advances only its path to the root is replayed:
+// log2(k) comparisons per merged element. `precedes(a, b)` compares the
+// current heads of sources a and b and must order every pair strictly; an
+// exhausted source never precedes.
+template <class Precedes>
+class LoserTree {
+   public:
+    LoserTree(std::size_t sources, Precedes precedes);
+
+    std::size_t winner() const { return losers[0]; }
+    // Call after the winner's head has changed.
+    void replay();
+
+   private:
+    std::size_t sources;
+    std::size_t leaves;  // sources rounded up to a power of two
+    std::vector<std::size_t> losers;
+    Precedes precedes;
+
+    bool wins(std::size_t a, std::size_t b) const;
+    std::size_t play(std::size_t node);
 };
 
 class Ranking {
    public:
+    // How the bulk constructor sorts. RADIX runs an LSD radix sort over the
+    // packed rank keys, COMPARISON a parallel merge sort; the order is the
+    // same.
+    enum class BuildMode : std::uint8_t { RADIX, COMPARISON };
+
+    // Names one entry added with add(). It stays valid across insertions,
+    // merges into this ranking and copies of it, and goes stale once its
+    // entry is removed or the ranking is moved from or assigned over.
+    // Entries merged in from another ranking get no handle here.
+    class Handle {
+       public:
+        Handle() = default;
+        bool operator==(const Handle&) const = default;
+
+       private:
+        friend class Ranking;
+        Handle(std::uint64_t lineage, std::uint32_t id,
+               std::uint32_t generation)
+            : lineage(lineage), id(id), generation(generation) {}
+        std::uint64_t lineage = 0;
+        std::uint32_t id = std::uint32_t(-1);
+        std::uint32_t generation = 0;
+    };
+
+    // A ranking allocates its nodes, and the pickers in them, from its
+    // memory resource. Pickers added or merged in from elsewhere are copied
+    // into it. Copies keep the source's resource unless given another,
+    // assignment keeps the target's, and a result built from rankings
+    // (operator+, merge_all) uses the resource of the first one. Memory
+    // resources need not be thread-safe, so work spread over threads only
+    // allocates from new_delete_resource(); with any other resource the
+    // allocating steps run on the calling thread.
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     Ranking() = default;
-    Ranking(const Ranking&) = default;
-    Ranking(Ranking&&) noexcept = default;
+    explicit Ranking(const allocator_type& allocator);
+    Ranking(const Ranking& other) : Ranking(other, other.get_allocator()) {}
+    Ranking(const Ranking& other, const allocator_type& allocator);
+    Ranking(Ranking&& other) noexcept;
+    Ranking(Ranking&& other, const allocator_type& allocator);
 
-    Ranking& operator=(const Ranking&) = default;
-    Ranking& operator=(Ranking&&) noexcept = default;
+    Ranking& operator=(const Ranking& other);
+    Ranking& operator=(Ranking&& other);
+
+    allocator_type get_allocator() const { return nodes.get_allocator(); }
 
     Ranking(const std::initializer_list<Picker>& pickers_list);
-    std::size_t count_pickers() const { return pickers.size(); };
+    // Builds a ranking from many pickers at once, ordered as if they were
+    // added one by one. Pickers are moved out of an owning rvalue range such
+    // as std::vector<Picker>&& and copied otherwise. The sort runs on
+    // `threads` workers, 0 meaning one per hardware thread.
+    template <std::ranges::input_range R>
+        requires std::convertible_to<std::ranges::range_reference_t<R>,
+                                     const Picker&>
+    explicit Ranking(R&& pickers, std::size_t threads = 0,
+                     BuildMode mode = BuildMode::RADIX,
+                     const allocator_type& allocator = {});
+    std::size_t count_pickers() const {
+        settle();
+        return subtree_size(root);
+    };
     friend std::ostream& operator<<(std::ostream& os, const Ranking& ranking);
 
     Ranking& operator+=(const Ranking& other);
@@ -108,379 +776,1973 @@ class Ranking {
     Ranking& operator+=(const Picker& picker);
     Ranking& operator-=(const Picker& picker);
 
+    // Adds like operator+= and returns a handle to the new entry.
+    Handle add(const Picker& picker);
+    // Replaces the handle's picker and moves the entry to its new rank in
+    // O(log n) expected; it then ties as if just added. Stale handles throw
+    // std::out_of_range here and in the queries below.
+    void update(Handle handle, const Picker& picker);
+    void remove(Handle handle);
+    bool contains(Handle handle) const;
+    const Picker& at(Handle handle) const;
+    std::size_t rank_of(Handle handle) const;
+
     Ranking operator+(const Ranking& other) const;
 
+    // Merges many rankings at once with a stable k-way merge. Ties keep the
+    // order of `rankings`, exactly as adding them one by one with operator+=
+    // would. Large merges are split by rank ranges over `threads` workers,
+    // 0 meaning one per hardware thread. The rvalue form moves the pickers
+    // and leaves the rankings empty.
+    static Ranking merge_all(std::span<const Ranking> rankings,
+                             std::size_t threads = 0);
+    static Ranking merge_all(std::vector<Ranking>&& rankings,
+                             std::size_t threads = 0);
+
     const Picker& operator[](std::size_t index) const;
+    // The best `k` pickers, best first, in O(k + log n).
+    std::vector<Picker> top(std::size_t k) const;
+    // Calls `visit` with every picker, best first, without copying any.
+    template <class Visit>
+    void for_each(Visit&& visit) const;
+
+   private:
+    // Pickers live in an order-statistic treap keyed by (picker ordering,
+    // insertion order), so pickers that compare equal keep the order in
+    // which they were added. Nodes sit in one vector and link by index;
+    // every node knows its subtree size, which makes insertion, removal and
+    // lookup by rank O(log n) expected. Nodes are also chained into hash
+    // buckets by picker fingerprint, so a removal finds its target without
+    // walking the tree.
+    //
+    // Adding a picker only allocates its node and queues it in `pending`;
+    // the next read settles the queue, so a run of insertions is sorted
+    // once. Reads are const, so the first one settles under a lock and
+    // several threads may read the same Ranking at once, as with any other
+    // standard container.
+    using NodeIndex = std::uint32_t;
+    static constexpr NodeIndex NIL = NodeIndex(-1);
+
+    // Everything in a node but its picker.
+    struct NodeLinks {
+        std::uint64_t order = 0;
+        std::uint64_t priority = 0;
+        std::uint64_t fingerprint = 0;
+        NodeIndex left = NIL;
+        NodeIndex right = NIL;
+        NodeIndex next_in_bucket = NIL;
+        std::uint32_t handle = NIL;  // index into `handles`, if any
+        std::uint32_t subtree = 1;
+    };
+
+    // Allocator-aware, so a node vector puts every picker it takes in its
+    // own resource.
+    struct Node : NodeLinks {
+        using allocator_type = Ranking::allocator_type;
+
+        Picker picker;
+
+        Node() = default;
+        explicit Node(const allocator_type& allocator) : picker(allocator) {}
+        explicit Node(Picker picker, std::uint64_t order = 0,
+                      std::uint64_t priority = 0,
+                      std::uint64_t fingerprint = 0)
+            : NodeLinks{order, priority, fingerprint},
+              picker(std::move(picker)) {}
+        Node(const Node& other) = default;
+        Node(const Node& other, const allocator_type& allocator)
+            : NodeLinks(other), picker(other.picker, allocator) {}
+        Node(Node&& other) noexcept = default;
+        Node(Node&& other, const allocator_type& allocator)
+            : NodeLinks(other), picker(std::move(other.picker), allocator) {}
+        Node& operator=(const Node& other) = default;
+        Node& operator=(Node&& other) = default;
+    };
+    using NodeVector = std::pmr::vector<Node>;
+
+    // A handle is live while its generation matches; releasing it bumps
+    // the generation, so reusing the slot never revives old handles.
+    struct HandleSlot {
+        NodeIndex node;
+        std::uint32_t generation;
+    };
+
+    NodeVector nodes;
+    std::pmr::vector<NodeIndex> free_nodes;
+    std::pmr::vector<NodeIndex> buckets;  // empty or a power of two in size
+    std::pmr::vector<NodeIndex> pending;  // allocated, not yet in the tree
+    std::pmr::vector<HandleSlot> handles;
+    std::pmr::vector<std::uint32_t> free_handles;
+    NodeIndex root = NIL;
+    std::uint64_t next_order = 0;
+    std::uint64_t priority_state = 0;
+    // Stamped on every handle. Copies share the handle table and so the
+    // lineage; an emptied or reassigned ranking starts a new one, so the
+    // ids it hands out again never match handles from before.
+    std::uint64_t lineage = next_lineage();
+
+    // Set by insertions, cleared once the next read has settled them.
+    // Copies carry the flag but never share the lock.
+    struct SettleState {
+        std::atomic<bool> unsettled = false;
+        std::mutex mutex;
+
+        SettleState() = default;
+        SettleState(const SettleState& other)
+            : unsettled(other.unsettled.load(std::memory_order_relaxed)) {}
+        SettleState& operator=(const SettleState& other) {
+            unsettled.store(other.unsettled.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+            return *this;
+        }
+    };
+    mutable SettleState settle_state;
+
+    std::size_t subtree_size(NodeIndex t) const {
+        return t == NIL ? 0 : nodes[t].subtree;
+    }
+    bool precedes(NodeIndex a, NodeIndex b) const;
+    void refresh(NodeIndex t);
+    std::pair<NodeIndex, NodeIndex> split(NodeIndex t, NodeIndex key);
+    NodeIndex join(NodeIndex a, NodeIndex b);
+    NodeIndex unlink(NodeIndex t, NodeIndex key);
+
+    void settle() const;
+    void settle_pending();
+
+    static std::uint64_t next_lineage() {
+        static std::atomic<std::uint64_t> last{0};
+        return last.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    std::uint64_t next_priority();
+    NodeIndex allocate(const Picker& picker);
+    void insert(NodeIndex node);
+    void erase(NodeIndex node);
+    NodeIndex node_at(std::size_t rank) const;
+    NodeIndex node_of(Handle handle) const;
+    std::vector<NodeIndex> in_order(
+        std::size_t limit = std::numeric_limits<std::size_t>::max()) const;
+    void assign_sorted(NodeVector&& sorted);
+    std::uint32_t build_subtree_sizes(NodeIndex t);
+
+    std::size_t bucket_of(std::uint64_t fingerprint) const;
+    void link_bucket(NodeIndex node);
+    void unlink_bucket(NodeIndex node);
+    void rehash(std::size_t bucket_count);
+
+    template <class Other>
+    void merge_in(Other&& other);
+    template <class Visit>
+    void visit_in_order(NodeIndex t, Visit& visit) const;
+
+    static std::size_t worker_count(std::size_t items, std::size_t threads);
+    // `workers`, or 1 if they would share a resource that may not be
+    // thread-safe.
+    static std::size_t allocating_workers(std::size_t workers,
+                                          const allocator_type& allocator);
+    template <class Work>
+    static void run_workers(std::size_t workers, Work&& work);
+    template <class Precedes, class Emit>
+    static void merge_runs(const std::vector<std::size_t>& run_sizes,
+                           Precedes precedes, Emit emit, std::size_t workers);
+    template <class Source>
+    static Ranking merge_sources(std::span<Source> sources,
+                                 std::size_t threads);
+
+    struct SortEntry {
+        RankKey key;
+        NodeIndex index;
+    };
+    void assign_unsorted(NodeVector&& unsorted, std::size_t threads,
+                         BuildMode mode);
+    static void comparison_sort(std::vector<SortEntry>& entries,
+                                const std::vector<std::size_t>& bounds);
+    static void radix_sort(std::vector<SortEntry>& entries,
+                           const std::vector<std::size_t>& bounds);
+    template <class Entry, class Digit>
+    static void lsd_radix_sort(std::vector<Entry>& entries,
+                               const std::vector<std::size_t>& bounds,
+                               std::size_t digits, Digit digit);
+
+    friend class Snapshot;
+};
+
+// Keeps only the best `k` pickers of everything added, for when nothing past
+// the podium is ever read. A bounded heap with the worst kept picker on top
+// makes adding O(log k) and memory O(k). Equal pickers rank in the order in
+// which they were added, so the result matches the first k entries of a
+// Ranking holding every added picker.
+class TopKRanking {
+   public:
+    explicit TopKRanking(std::size_t k) : k(k) { heap.reserve(k); }
+
+    std::size_t capacity() const { return k; }
+    std::size_t count_pickers() const { return heap.size(); }
+
+    TopKRanking& operator+=(const Picker& picker);
+    TopKRanking& operator+=(Picker&& picker);
+
+    // Best first; sorts the O(k) kept pickers.
+    std::vector<Picker> top() const;
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const TopKRanking& ranking);
 
    private:
-    std::vector<Picker> pickers;
+    struct Entry {
+        Picker picker;
+        std::uint64_t order;
+    };
+
+    std::size_t k;
+    std::vector<Entry> heap;
+    std::uint64_t next_order = 0;
+
+    static bool ranks_before(const Entry& a, const Entry& b);
+    bool admits(const Picker& picker) const;
+    template <class P>
+    void add(P&& picker);
 };
 
+constexpr FruitCode FruitCode::encode(Taste taste, Size size,
+                                      Quality quality) {
+    return FruitCode(static_cast<value_type>(
+        (static_cast<value_type>(taste) << TASTE_SHIFT) |
+        (static_cast<value_type>(size) << SIZE_SHIFT) |
+        static_cast<value_type>(quality)));
+}
+
 constexpr Fruit::Fruit(Taste taste, Size size, Quality quality)
-    : fruit_taste(taste), fruit_size(size), fruit_quality(quality) {}
+    : fruit_code(FruitCode::encode(taste, size, quality)) {}
 
 constexpr Fruit::Fruit(std::tuple<Taste, Size, Quality> tpl)
-    : fruit_taste(std::get<0>(tpl)),
-      fruit_size(std::get<1>(tpl)),
-      fruit_quality(std::get<2>(tpl)) {}
+    : fruit_code(FruitCode::encode(std::get<0>(tpl), std::get<1>(tpl),
+                                   std::get<2>(tpl))) {}
 
 inline void Fruit::become_worm_infested() {
-    if (fruit_quality == Quality::HEALTHY) {
-        fruit_quality = Quality::WORMY;
+    if (quality() == Quality::HEALTHY) {
+        fruit_code = fruit_code.with_quality(Quality::WORMY);
     }
 }
 
 inline void Fruit::go_rotten() {
-    if (fruit_quality == Quality::HEALTHY) {
-        fruit_quality = Quality::ROTTEN;
+    if (quality() == Quality::HEALTHY) {
+        fruit_code = fruit_code.with_quality(Quality::ROTTEN);
     }
 }
 
-inline std::ostream& operator<<(std::ostream& os, const Fruit& fruit) {
-    switch (fruit.taste()) {
-        case Taste::SWEET:
-            os << "[słodki";
-            break;
-        case Taste::SOUR:
-            os << "[kwaśny";
-            break;
-    }
-    switch (fruit.size()) {
-        case Size::LARGE:
-            os << " duży";
-            break;
-        case Size::MEDIUM:
-            os << " średni";
-            break;
-        case Size::SMALL:
-            os << " mały";
-            break;
-    }
-    switch (fruit.quality()) {
-        case Quality::HEALTHY:
-            os << " zdrowy]";
-            break;
-        case Quality::ROTTEN:
-            os << " nadgniły]";
-            break;
-        case Quality::WORMY:
-            os << " robaczywy]";
-            break;
+inline FruitLog::FruitLog(const FruitLog& other)
+    : allocator(other.allocator),
+      block(other.block),
+      head(other.head),
+      tail(other.tail) {
+    if (block) {
+        block->references.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        std::memcpy(inline_bytes, other.inline_bytes, INLINE_CAPACITY);
     }
-    return os;
 }
 
-inline Picker::Picker(std::string_view name)
-    : picker_name(name.empty() ? DEFAULT_PICKER_NAME : std::string(name)) {}
-
-inline std::size_t Picker::count_taste(Taste t) const {
-    switch (t) {
-        case Taste::SWEET:
-            return sweet_count;
-        case Taste::SOUR:
-            return sour_count;
+// Storage is only ever shared within one resource, so whichever log drops
+// the last reference can return it.
+inline FruitLog::FruitLog(const FruitLog& other,
+                          const allocator_type& allocator)
+    : allocator(allocator) {
+    if (allocator == other.allocator) {
+        *this = FruitLog(other);
+    } else {
+        append(other.fruits());
     }
-    return 0;
 }
 
-inline std::size_t Picker::count_size(Size s) const {
-    switch (s) {
-        case Size::LARGE:
-            return large_count;
-        case Size::MEDIUM:
-            return medium_count;
-        case Size::SMALL:
-            return small_count;
-    }
-    return 0;
+inline FruitLog::FruitLog(FruitLog&& other) noexcept
+    : allocator(other.allocator),
+      block(std::exchange(other.block, nullptr)),
+      head(std::exchange(other.head, 0)),
+      tail(std::exchange(other.tail, 0)) {
+    if (!block) std::memcpy(inline_bytes, other.inline_bytes, INLINE_CAPACITY);
 }
 
-inline std::size_t Picker::count_quality(Quality q) const {
-    switch (q) {
-        case Quality::HEALTHY:
-            return healthy_count;
-        case Quality::WORMY:
-            return wormy_count;
-        case Quality::ROTTEN:
-            return rotten_count;
-    }
-    return 0;
+inline FruitLog::FruitLog(FruitLog&& other, const allocator_type& allocator)
+    : allocator(allocator) {
+    *this = std::move(other);
 }
 
-inline std::ostream& operator<<(std::ostream& os, const Picker& picker) {
-    os << picker.picker_name << ":";
-
-    const auto& fruits = picker.collected_fruits;
-    if (fruits.empty()) return os;
+inline FruitLog& FruitLog::operator=(const FruitLog& other) {
+    if (this != &other) *this = FruitLog(other, allocator);
+    return *this;
+}
 
-    os << "\n\t" << fruits[0];
+inline FruitLog& FruitLog::operator=(FruitLog&& other) {
+    if (this == &other) return *this;
+    if (allocator != other.allocator) return *this = other;
+    release();
+    block = std::exchange(other.block, nullptr);
+    head = std::exchange(other.head, 0);
+    tail = std::exchange(other.tail, 0);
+    if (!block) std::memcpy(inline_bytes, other.inline_bytes, INLINE_CAPACITY);
+    return *this;
+}
 
-    for (size_t i = 1; i < fruits.size(); ++i) {
-        os << "\n\t" << fruits[i];
-    }
+inline FruitLog::~FruitLog() { release(); }
 
-    return os;
+inline bool FruitLog::is_shared() const {
+    return block && block->references.load(std::memory_order_acquire) > 1;
 }
 
-inline bool Picker::operator==(const Picker& other) const {
-    return picker_name == other.picker_name &&
-           std::equal(collected_fruits.begin(), collected_fruits.end(),
-                      other.collected_fruits.begin(),
-                      other.collected_fruits.end());
+inline FruitLog::Block* FruitLog::allocate_block(size_type capacity) {
+    void* memory =
+        allocator.allocate_bytes(sizeof(Block) + capacity, alignof(Block));
+    return new (memory) Block{{1}, capacity};
 }
 
-inline Picker& Picker::operator+=(const Fruit& fruit) {
-    collected_fruits.push_back(fruit);
-
-    switch (fruit.quality()) {
-        case Quality::HEALTHY:
-            healthy_count++;
-            break;
-        case Quality::WORMY:
-            wormy_count++;
-            break;
-        case Quality::ROTTEN:
-            rotten_count++;
-            break;
-    }
-    switch (fruit.taste()) {
-        case Taste::SWEET:
-            sweet_count++;
-            break;
-        case Taste::SOUR:
-            sour_count++;
-            break;
-    }
-    switch (fruit.size()) {
-        case Size::LARGE:
-            large_count++;
-            break;
-        case Size::MEDIUM:
-            medium_count++;
-            break;
-        case Size::SMALL:
-            small_count++;
-            break;
+inline void FruitLog::release() {
+    if (block &&
+        block->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        const size_type bytes = sizeof(Block) + block->capacity;
+        block->~Block();
+        allocator.deallocate_bytes(block, bytes, alignof(Block));
     }
-
-    handle_rot_between_last_two();
-    handle_worm_infection();
-    return *this;
+    block = nullptr;
+    head = tail = 0;
 }
 
-inline void Picker::decrement_counters_for(const Fruit& f) {
-    switch (f.quality()) {
-        case Quality::HEALTHY:
-            healthy_count--;
-            break;
-        case Quality::WORMY:
-            wormy_count--;
-            break;
-        case Quality::ROTTEN:
-            rotten_count--;
-            break;
-    }
-    switch (f.taste()) {
-        case Taste::SWEET:
-            sweet_count--;
-            break;
-        case Taste::SOUR:
-            sour_count--;
-            break;
-    }
-    switch (f.size()) {
-        case Size::LARGE:
-            large_count--;
-            break;
-        case Size::MEDIUM:
-            medium_count--;
-            break;
-        case Size::SMALL:
-            small_count--;
-            break;
+// Moves the live fruits into storage owned by this log alone: the inline
+// bytes if `new_capacity` fits there, a fresh block otherwise.
+inline void FruitLog::reallocate(size_type new_capacity) {
+    const size_type live = size();
+    if (new_capacity > INLINE_CAPACITY) {
+        Block* fresh = allocate_block(new_capacity);
+        std::memcpy(fresh->fruits(), data(), live);
+        release();
+        block = fresh;
+    } else {
+        std::memmove(inline_bytes, data(), live);
+        release();
     }
+    tail = live;
 }
 
-inline void Picker::handle_rot_between_last_two() {
-    if (collected_fruits.size() < 2) return;
-
-    Fruit& last = collected_fruits.back();
-    Fruit& second_last = collected_fruits[collected_fruits.size() - 2];
+inline std::span<Fruit> FruitLog::mutable_fruits() {
+    if (is_shared()) reallocate(size());
+    return {storage() + head, size()};
+}
 
-    if (last.quality() == Quality::ROTTEN &&
-        second_last.quality() == Quality::HEALTHY) {
-        healthy_count--;
-        rotten_count++;
+inline void FruitLog::reserve(size_type count) {
+    if (count > size()) make_room(count - size());
+}
 
-        second_last.go_rotten();
-    } else if (last.quality() == Quality::HEALTHY &&
-               second_last.quality() == Quality::ROTTEN) {
-        healthy_count--;
-        rotten_count++;
+inline void FruitLog::make_room(size_type extra) {
+    if (tail + extra <= capacity() && !is_shared()) return;
+    grow(extra);
+}
 
-        last.go_rotten();
+// Kept out of make_room, so appending stays small enough to inline. Inline
+// fruits slide down whenever that makes room, as they are few; a block
+// that has to be replaced gives way to the inline bytes if they suffice.
+inline void FruitLog::grow(size_type extra) {
+    const size_type live = size();
+    if (!is_shared() && live + extra <= capacity() &&
+        (!block || head >= live)) {
+        std::memmove(storage(), storage() + head, live);
+        head = 0;
+        tail = live;
+        return;
     }
+    reallocate(live + extra <= INLINE_CAPACITY
+                   ? INLINE_CAPACITY
+                   : std::max(capacity() * 2, live + extra));
 }
 
-inline void Picker::handle_worm_infection() {
-    if (collected_fruits.empty()) return;
+inline void FruitLog::push_back(const Fruit& fruit) {
+    make_room(1);
+    std::construct_at(storage() + tail, fruit);
+    ++tail;
+}
 
-    static constexpr std::deque<Fruit>::size_type no_worm_index = -1;
-    auto new_idx = collected_fruits.size() - 1;
+inline void FruitLog::append(std::span<const Fruit> fruits) {
+    if (fruits.empty()) return;
+    make_room(fruits.size());
+    std::memcpy(storage() + tail, fruits.data(), fruits.size());
+    tail += fruits.size();
+}
 
-    if (collected_fruits[new_idx].quality() != Quality::WORMY) return;
+// Popping never writes to the storage, so it does not unshare it.
+inline void FruitLog::pop_front(size_type count) {
+    head += count;
+    if (head != tail) return;
+    if (is_shared()) {
+        release();
+    } else {
+        head = tail = 0;
+    }
+}
 
-    auto start = (last_wormy_index == no_worm_index) ? 0 : last_wormy_index + 1;
+inline std::size_t FruitHistogram::count(std::optional<Taste> taste,
+                                         std::optional<Size> size,
+                                         std::optional<Quality> quality) const {
+    // The values an attribute ranges over: the given one, or all of them.
+    auto values = [](auto attribute, std::size_t all) {
+        if (!attribute) return std::pair<std::size_t, std::size_t>{0, all};
+        const auto value = static_cast<std::size_t>(*attribute);
+        return std::pair{value, value + 1};
+    };
+    const auto [t_begin, t_end] = values(taste, TASTES);
+    const auto [s_begin, s_end] = values(size, SIZES);
+    const auto [q_begin, q_end] = values(quality, QUALITIES);
+    std::size_t total = 0;
+    for (std::size_t t = t_begin; t < t_end; ++t) {
+        for (std::size_t s = s_begin; s < s_end; ++s) {
+            for (std::size_t q = q_begin; q < q_end; ++q) {
+                total += buckets[bucket(t, s, q)];
+            }
+        }
+    }
+    return total;
+}
 
-    auto subrange = collected_fruits | std::views::drop(start) |
-                    std::views::take(new_idx - start);
+inline void FruitHistogram::add(FruitCode code, std::size_t n) {
+    buckets[bucket_of(code)] += n;
+}
 
-    std::ranges::for_each(subrange, [this](Fruit& f) {
-        if (f.quality() == Quality::HEALTHY && f.taste() == Taste::SWEET) {
-            f.become_worm_infested();
+inline void FruitHistogram::remove(FruitCode code, std::size_t n) {
+    buckets[bucket_of(code)] -= n;
+}
 
-            healthy_count--;
-            wormy_count++;
-        }
-    });
+inline void FruitHistogram::move(FruitCode from, FruitCode to, std::size_t n) {
+    remove(from, n);
+    add(to, n);
+}
 
-    last_wormy_index = new_idx;
+inline void FruitHistogram::apply(const Delta& delta) {
+    for (std::size_t value = 0; value < delta.size(); ++value) {
+        if (delta[value] == 0) continue;
+        // Unsigned wrap-around makes adding a negative delta a subtraction.
+        buckets[bucket_of(FruitCode::from_value(
+            static_cast<FruitCode::value_type>(value)))] +=
+            static_cast<std::size_t>(delta[value]);
+    }
 }
 
-inline Picker& Picker::operator-=(Picker& other) {
-    if (&other == this) return *this;
-    if (collected_fruits.empty()) return *this;
+constexpr RankKey RankKey::contribution(FruitCode code) {
+    auto pair = [](bool high, bool low) {
+        return (Pair(high) << 64) | Pair(low);
+    };
+    RankKey key;
+    key.primary = pair(code.quality() == Quality::HEALTHY,
+                       code.taste() == Taste::SWEET);
+    key.secondary =
+        pair(code.size() == Size::LARGE, code.size() == Size::MEDIUM);
+    key.tertiary = code.size() == Size::SMALL;
+    return key;
+}
 
-    Fruit stolen_fruit = collected_fruits.front();
-    decrement_counters_for(stolen_fruit);
-    collected_fruits.pop_front();
-    adjust_index_after_pop_front();
-    other += stolen_fruit;
+// Free of branches: small pickers often tie on a pair, so which field
+// decides is hard to predict.
+constexpr std::strong_ordering RankKey::operator<=>(
+    const RankKey& other) const {
+    auto sign = [](auto a, auto b) { return int(a > b) - int(a < b); };
+    const int first = sign(primary, other.primary);
+    const int second = sign(secondary, other.secondary);
+    const int third = sign(tertiary, other.tertiary);
+    return (first != 0 ? first : second != 0 ? second : third) <=> 0;
+}
 
-    return *this;
+// Contributions are precomputed per code. Arithmetic wraps, so a batch of
+// additions and removals in any order ends on the exact counts. `n` is
+// widened with its sign, so a removal, added as 0 - n, borrows across the
+// two halves of a pair exactly as subtracting n would.
+constexpr void RankKey::add(FruitCode code, std::uint64_t n) {
+    constexpr auto table = [] {
+        std::array<RankKey, FruitCode::VALUE_COUNT> t{};
+        for (std::size_t v = 0; v < t.size(); ++v) {
+            t[v] = contribution(
+                FruitCode::from_value(static_cast<FruitCode::value_type>(v)));
+        }
+        return t;
+    }();
+    const RankKey& c = table[code.value()];
+    const auto wide = static_cast<Pair>(static_cast<std::int64_t>(n));
+    primary += c.primary * wide;
+    secondary += c.secondary * wide;
+    tertiary += c.tertiary * n;
 }
 
-inline Picker& Picker::operator+=(Picker& other) {
-    if (&other == this) return *this;
-    if (other.collected_fruits.empty()) return *this;
+constexpr void RankKey::remove(FruitCode code, std::uint64_t n) {
+    add(code, std::uint64_t(0) - n);
+}
+
+constexpr void FruitFingerprint::push_back(FruitCode code) {
+    hash += (code.value() + std::uint64_t(1)) * next_weight;
+    next_weight *= BASE;
+}
 
-    Fruit stolen_fruit = other.collected_fruits.front();
+constexpr void FruitFingerprint::pop_front(FruitCode code) {
+    hash = (hash - (code.value() + std::uint64_t(1))) * BASE_INVERSE;
+    next_weight *= BASE_INVERSE;
+}
 
-    other.decrement_counters_for(stolen_fruit);
+constexpr void FruitFingerprint::pop_front(std::span<const Fruit> fruits) {
+    std::uint64_t prefix = 0, weight = 1;
+    for (Fruit fruit : fruits) {
+        prefix += (fruit.code().value() + std::uint64_t(1)) * weight;
+        weight *= BASE;
+    }
+    const std::uint64_t shift = power(BASE_INVERSE, fruits.size());
+    hash = (hash - prefix) * shift;
+    next_weight *= shift;
+}
 
-    other.collected_fruits.pop_front();
-    other.adjust_index_after_pop_front();
+constexpr FruitFingerprint FruitFingerprint::from_value(std::uint64_t value,
+                                                        std::size_t size) {
+    FruitFingerprint result;
+    result.hash = value;
+    result.next_weight = power(BASE, size);
+    return result;
+}
 
-    *this += stolen_fruit;
+constexpr std::uint64_t FruitFingerprint::weight(std::size_t position) const {
+    return power(BASE, position);
+}
 
-    return *this;
+constexpr std::uint64_t FruitFingerprint::power(std::uint64_t base,
+                                                std::size_t exponent) {
+    std::uint64_t result = 1;
+    for (; exponent != 0; exponent >>= 1) {
+        if (exponent & 1) result *= base;
+        base *= base;
+    }
+    return result;
 }
 
+constexpr std::uint64_t FruitFingerprint::weight_from_back(
+    std::size_t distance) const {
+    std::uint64_t result = next_weight;
+    while (distance-- != 0) result *= BASE_INVERSE;
+    return result;
+}
 
-inline Picker& Picker::operator+=(Picker&&) { return *this; }
+constexpr void FruitFingerprint::replace(std::uint64_t weight, FruitCode from,
+                                         FruitCode to) {
+    hash += weight * (std::uint64_t(to.value()) - from.value());
+}
 
-inline Picker& Picker::operator-=(Picker&&) { return *this; }
+// The text operator<< prints for every fruit, rendered at compile time and
+// indexed by FruitCode value; invalid values render as nothing.
+namespace fruit_text {
 
-inline auto Picker::operator<=>(const Picker& other) const {
-    using CountFn = std::function<std::size_t(const Picker&)>;
+struct Rendered {
+    std::array<char, 32> bytes{};
+    std::size_t size = 0;
 
-    CountFn fns[] = {
-        [](const Picker& p) { return p.count_quality(Quality::HEALTHY); },
-        [](const Picker& p) { return p.count_taste(Taste::SWEET); },
-        [](const Picker& p) { return p.count_size(Size::LARGE); },
-        [](const Picker& p) { return p.count_size(Size::MEDIUM); },
-        [](const Picker& p) { return p.count_size(Size::SMALL); },
-        [](const Picker& p) { return p.count_fruits(); }};
+    constexpr std::string_view view() const { return {bytes.data(), size}; }
+};
 
-    for (auto& fn : fns) {
-        auto lhs = fn(*this);
-        auto rhs = fn(other);
-        if (lhs != rhs) return rhs <=> lhs;
+inline constexpr auto FRUITS = [] {
+    constexpr std::string_view tastes[] = {"słodki", "kwaśny"};
+    constexpr std::string_view sizes[] = {"duży", "średni", "mały"};
+    constexpr std::string_view qualities[] = {"zdrowy", "nadgniły",
+                                              "robaczywy"};
+    std::array<Rendered, FruitCode::VALUE_COUNT> table{};
+    for (std::size_t t = 0; t < std::size(tastes); ++t) {
+        for (std::size_t s = 0; s < std::size(sizes); ++s) {
+            for (std::size_t q = 0; q < std::size(qualities); ++q) {
+                auto code = FruitCode::encode(static_cast<Taste>(t),
+                                              static_cast<Size>(s),
+                                              static_cast<Quality>(q));
+                Rendered& out = table[code.value()];
+                for (std::string_view piece :
+                     {std::string_view("["), tastes[t], std::string_view(" "),
+                      sizes[s], std::string_view(" "), qualities[q],
+                      std::string_view("]")}) {
+                    for (char c : piece) out.bytes[out.size++] = c;
+                }
+            }
+        }
     }
+    return table;
+}();
 
-    return std::strong_ordering::equal;
+constexpr std::string_view render(const Fruit& fruit) {
+    return FRUITS[fruit.code().value()].view();
 }
 
-inline void Picker::adjust_index_after_pop_front() {
-    const auto npos = std::deque<Fruit>::size_type(-1);
-
-    if (last_wormy_index == npos) {
-        return;
-    }
+}  // namespace fruit_text
 
-    last_wormy_index = (last_wormy_index == 0) ? npos : last_wormy_index - 1;
+inline std::ostream& operator<<(std::ostream& os, const Fruit& fruit) {
+    return os << fruit_text::render(fruit);
 }
 
-inline Ranking::Ranking(const std::initializer_list<Picker>& pickers_list) {
-    pickers = std::vector<Picker>(pickers_list);
-    std::stable_sort(pickers.begin(), pickers.end(), std::less<Picker>());
+inline Picker::Picker(std::string_view name, const allocator_type& allocator)
+    : picker_name(name.empty() ? DEFAULT_PICKER_NAME : name, allocator),
+      collected_fruits(allocator) {}
+
+inline Picker::Picker(const Picker& other, const allocator_type& allocator)
+    : ranking_key(other.ranking_key),
+      picker_name(other.picker_name, allocator),
+      collected_fruits(other.collected_fruits, allocator),
+      histogram(other.histogram),
+      content_fingerprint(other.content_fingerprint),
+      last_wormy_index(other.last_wormy_index) {}
+
+inline Picker::Picker(Picker&& other, const allocator_type& allocator)
+    : ranking_key(other.ranking_key),
+      picker_name(std::move(other.picker_name), allocator),
+      collected_fruits(std::move(other.collected_fruits), allocator),
+      histogram(other.histogram),
+      content_fingerprint(other.content_fingerprint),
+      last_wormy_index(other.last_wormy_index) {}
+
+inline Picker Picker::from_history(std::string_view name,
+                                   std::span<const Fruit> fruits,
+                                   const allocator_type& allocator) {
+    Picker picker{name, allocator};
+    picker.collected_fruits.append(fruits);
+    FruitHistogram::Delta delta{};
+    for (std::size_t i = 0; i < fruits.size(); ++i) {
+        const FruitCode code = fruits[i].code();
+        ++delta[code.value()];
+        picker.content_fingerprint.push_back(code);
+        if (code.quality() == Quality::WORMY) picker.last_wormy_index = i;
+    }
+    picker.apply_delta(delta);
+    return picker;
 }
 
-inline Ranking& Ranking::operator+=(const Picker& picker) {
-    pickers.push_back(picker);
-    std::stable_sort(pickers.begin(), pickers.end(), std::less<Picker>());
-    return *this;
+inline std::size_t Picker::count_taste(Taste t) const {
+    return histogram.count(t);
 }
 
-inline Ranking& Ranking::operator+=(Ranking&&) { return *this; }
-
-inline const Picker& Ranking::operator[](std::size_t index) const {
-    if (pickers.empty()) {
-        throw std::out_of_range("Ranking is empty");
-    }
-    if (index >= pickers.size()) {
-        return pickers.back();
-    }
-    return pickers[index];
+inline std::size_t Picker::count_size(Size s) const {
+    return histogram.count(std::nullopt, s);
 }
 
-inline std::ostream& operator<<(std::ostream& os, const Ranking& ranking) {
-    if (ranking.pickers.empty()) return os;
+inline std::size_t Picker::count_quality(Quality q) const {
+    return histogram.count(std::nullopt, std::nullopt, q);
+}
 
-    os << ranking.pickers[0];
+inline std::ostream& operator<<(std::ostream& os, const Picker& picker) {
+    os << picker.picker_name << ":";
 
-    for (size_t i = 1; i < ranking.pickers.size(); ++i) {
-        os << "\n" << ranking.pickers[i];
+    for (const Fruit& fruit : picker.collected_fruits) {
+        os << "\n\t" << fruit;
     }
 
-    os << "\n";
     return os;
 }
 
-inline Ranking& Ranking::operator-=(const Picker& picker) {
-    auto it = std::find(pickers.begin(), pickers.end(), picker);
-    if (it != pickers.end()) pickers.erase(it);
+inline bool Picker::operator==(const Picker& other) const {
+    // Fruit is a single trivially copyable byte, so equal bytes mean equal
+    // fruits and the whole history can be compared with one memcmp.
+    return content_fingerprint == other.content_fingerprint &&
+           picker_name == other.picker_name &&
+           collected_fruits.size() == other.collected_fruits.size() &&
+           (collected_fruits.empty() ||
+            std::memcmp(collected_fruits.begin(),
+                        other.collected_fruits.begin(),
+                        collected_fruits.size()) == 0);
+}
+
+inline std::uint64_t Picker::fingerprint() const {
+    std::uint64_t seed = std::hash<std::string_view>{}(picker_name);
+    return seed ^ (content_fingerprint.value() + 0x9e3779b97f4a7c15ULL +
+                   (seed << 6) + (seed >> 2));
+}
+
+inline Picker& Picker::operator+=(const Fruit& fruit) {
+    FRUIT_STATS_TIME(PICKER_ADD);
+    collected_fruits.push_back(fruit);
+    count_in(fruit.code());
+    content_fingerprint.push_back(fruit.code());
+
+    handle_rot_between_last_two();
+    handle_worm_infection();
     return *this;
 }
 
-inline Ranking& Ranking::operator+=(const Ranking& other) {
-    std::vector<Picker> merged;
-    merged.reserve(pickers.size() + other.pickers.size());
+inline Picker& Picker::add_range(std::span<const Fruit> fruits) {
+    FRUIT_STATS_TIME(PICKER_ADD_RANGE);
+    append_fused(fruits.begin(), fruits.end());
+    return *this;
+}
+
+template <std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>, Fruit> &&
+             (!std::convertible_to<R, std::span<const Fruit>>)
+Picker& Picker::add_range(R&& fruits) {
+    FRUIT_STATS_TIME(PICKER_ADD_RANGE);
+    if constexpr (std::ranges::sized_range<R>) {
+        collected_fruits.reserve(collected_fruits.size() +
+                                 std::ranges::size(fruits));
+    }
+    append_fused(std::ranges::begin(fruits), std::ranges::end(fruits));
+    return *this;
+}
+
+// Applies the rot rule while appending and defers the worm rule to a single
+// sweep up to the last WORMY fruit of the batch. This matches repeated
+// operator+= because a fruit's quality only changes through the rot rule
+// when it or its successor is appended, which always happens before any
+// later worm sweeps it, and qualities never return to HEALTHY.
+template <class It, class Sentinel>
+void Picker::append_fused(It first, Sentinel last) {
+    if constexpr (std::sized_sentinel_for<Sentinel, It>) {
+        collected_fruits.reserve(collected_fruits.size() +
+                                 static_cast<std::size_t>(last - first));
+    }
+
+    FruitHistogram::Delta delta{};
+    FruitLog::size_type last_worm = FruitLog::npos;
+
+    for (; first != last; ++first) {
+        Fruit fruit = *first;
+
+        if (!collected_fruits.empty()) {
+            Fruit& previous = collected_fruits.mutable_fruits().back();
+            if (fruit.quality() == Quality::ROTTEN &&
+                previous.quality() == Quality::HEALTHY) {
+                FruitCode before = previous.code();
+                --delta[before.value()];
+                previous.go_rotten();
+                FRUIT_STATS_ADD(ROT_CONVERSIONS, 1);
+                ++delta[previous.code().value()];
+                content_fingerprint.replace(
+                    content_fingerprint.weight_from_back(1), before,
+                    previous.code());
+            } else if (fruit.quality() == Quality::HEALTHY &&
+                       previous.quality() == Quality::ROTTEN) {
+                fruit.go_rotten();
+                FRUIT_STATS_ADD(ROT_CONVERSIONS, 1);
+            }
+        }
+
+        ++delta[fruit.code().value()];
+        collected_fruits.push_back(fruit);
+        content_fingerprint.push_back(fruit.code());
+        if (fruit.quality() == Quality::WORMY) {
+            last_worm = collected_fruits.size() - 1;
+        }
+    }
+
+    apply_delta(delta);
+
+    if (last_worm != FruitLog::npos) infect_up_to(last_worm);
+}
+
+inline void Picker::count_in(FruitCode code, std::size_t n) {
+    histogram.add(code, n);
+    ranking_key.add(code, n);
+}
+
+inline void Picker::count_out(FruitCode code, std::size_t n) {
+    histogram.remove(code, n);
+    ranking_key.remove(code, n);
+}
+
+inline void Picker::recount(FruitCode from, FruitCode to, std::size_t n) {
+    count_out(from, n);
+    count_in(to, n);
+}
+
+inline void Picker::apply_delta(const FruitHistogram::Delta& delta) {
+    histogram.apply(delta);
+    for (std::size_t value = 0; value < delta.size(); ++value) {
+        if (delta[value] == 0) continue;
+        ranking_key.add(
+            FruitCode::from_value(static_cast<FruitCode::value_type>(value)),
+            static_cast<std::uint64_t>(delta[value]));
+    }
+}
+
+// Runs the worm sweep over the fruits after the previous WORMY one and
+// before the one at `wormy_index`.
+inline void Picker::infect_up_to(FruitLog::size_type wormy_index) {
+    auto start =
+        (last_wormy_index == FruitLog::npos) ? 0 : last_wormy_index + 1;
+    auto swept =
+        collected_fruits.mutable_fruits().subspan(start, wormy_index - start);
+    if (!swept.empty()) {
+        auto weight = fruit_kernels::sweet_healthy_weight(
+            swept, content_fingerprint.weight(start));
+        const auto converted = fruit_kernels::infect_sweet_healthy(swept);
+        FRUIT_STATS_ADD(WORM_SWEEPS, 1);
+        FRUIT_STATS_ADD(WORM_SWEPT_FRUITS, swept.size());
+        FRUIT_STATS_ADD(WORM_INFECTED_FRUITS,
+                        converted[0] + converted[1] + converted[2]);
+        record_infected(converted, weight);
+    }
+    last_wormy_index = wormy_index;
+}
+
+// Infection only changes the quality bits, by the same amount for every
+// size, so the fingerprint takes the summed weight in one update.
+inline void Picker::record_infected(const fruit_kernels::SizeCounts& converted,
+                                    std::uint64_t weight) {
+    for (Size size : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+        recount(
+            FruitCode::encode(Taste::SWEET, size, Quality::HEALTHY),
+            FruitCode::encode(Taste::SWEET, size, Quality::WORMY),
+            converted[static_cast<std::size_t>(size)]);
+    }
+    content_fingerprint.replace(
+        weight, FruitCode::encode(Taste::SWEET, Size::LARGE, Quality::HEALTHY),
+        FruitCode::encode(Taste::SWEET, Size::LARGE, Quality::WORMY));
+}
+
+inline void Picker::handle_rot_between_last_two() {
+    if (collected_fruits.size() < 2) return;
+
+    auto fruits = collected_fruits.mutable_fruits();
+    Fruit& last = fruits[fruits.size() - 1];
+    Fruit& second_last = fruits[fruits.size() - 2];
+
+    if (last.quality() == Quality::ROTTEN &&
+        second_last.quality() == Quality::HEALTHY) {
+        FruitCode before = second_last.code();
+        second_last.go_rotten();
+        FRUIT_STATS_ADD(ROT_CONVERSIONS, 1);
+        recount(before, second_last.code());
+        content_fingerprint.replace(content_fingerprint.weight_from_back(2),
+                                    before, second_last.code());
+    } else if (last.quality() == Quality::HEALTHY &&
+               second_last.quality() == Quality::ROTTEN) {
+        FruitCode before = last.code();
+        last.go_rotten();
+        FRUIT_STATS_ADD(ROT_CONVERSIONS, 1);
+        recount(before, last.code());
+        content_fingerprint.replace(content_fingerprint.weight_from_back(1),
+                                    before, last.code());
+    }
+}
+
+inline void Picker::handle_worm_infection() {
+    if (collected_fruits.empty()) return;
+
+    auto new_idx = collected_fruits.size() - 1;
+
+    if (collected_fruits[new_idx].quality() != Quality::WORMY) return;
+
+    infect_up_to(new_idx);
+}
+
+inline Picker& Picker::operator-=(Picker& other) {
+    FRUIT_STATS_TIME(PICKER_TRANSFER);
+    if (&other == this) return *this;
+    if (collected_fruits.empty()) return *this;
+
+    other += take_front();
+
+    return *this;
+}
+
+inline Picker& Picker::operator+=(Picker& other) {
+    FRUIT_STATS_TIME(PICKER_TRANSFER);
+    if (&other == this) return *this;
+    if (other.collected_fruits.empty()) return *this;
+
+    *this += other.take_front();
+
+    return *this;
+}
+
+
+// A temporary is stolen from like any other picker; the fruit is moved
+// between the logs without touching the rest of its history.
+inline Picker& Picker::operator+=(Picker&& other) { return *this += other; }
+
+inline Picker& Picker::operator-=(Picker&& other) { return *this -= other; }
+
+// The stolen fruits are read straight from the giver's log, which stays
+// untouched until they have all been appended.
+inline Picker& Picker::steal_n(Picker& other, std::size_t n) {
+    FRUIT_STATS_TIME(PICKER_BULK_TRANSFER);
+    if (&other == this) return *this;
+    n = std::min(n, other.count_fruits());
+    if (n == 0) return *this;
+
+    auto taken = other.collected_fruits.fruits().first(n);
+    append_fused(taken.begin(), taken.end());
+    other.drop_front(n);
+    return *this;
+}
+
+inline Picker& Picker::give_n(Picker& other, std::size_t n) {
+    other.steal_n(*this, n);
+    return *this;
+}
+
+inline Fruit Picker::take_front() {
+    Fruit fruit = collected_fruits.front();
+    count_out(fruit.code());
+    content_fingerprint.pop_front(fruit.code());
+    collected_fruits.pop_front();
+    adjust_index_after_pop_front();
+    return fruit;
+}
+
+inline void Picker::drop_front(std::size_t n) {
+    auto dropped = collected_fruits.fruits().first(n);
+    FruitHistogram::Delta delta{};
+    for (Fruit fruit : dropped) --delta[fruit.code().value()];
+    apply_delta(delta);
+    content_fingerprint.pop_front(dropped);
+    collected_fruits.pop_front(n);
+
+    if (last_wormy_index != FruitLog::npos) {
+        last_wormy_index =
+            (last_wormy_index < n) ? FruitLog::npos : last_wormy_index - n;
+    }
+}
+
+inline void Picker::adjust_index_after_pop_front() {
+    if (last_wormy_index == FruitLog::npos) {
+        return;
+    }
+
+    last_wormy_index =
+        (last_wormy_index == 0) ? FruitLog::npos : last_wormy_index - 1;
+}
+
+template <class Precedes>
+LoserTree<Precedes>::LoserTree(std::size_t sources, Precedes precedes)
+    : sources(sources),
+      leaves(std::bit_ceil(std::max(sources, std::size_t(1)))),
+      losers(leaves),
+      precedes(std::move(precedes)) {
+    losers[0] = play(1);
+}
+
+// Padding leaves past `sources` lose every match.
+template <class Precedes>
+bool LoserTree<Precedes>::wins(std::size_t a, std::size_t b) const {
+    if (a >= sources) return false;
+    if (b >= sources) return true;
+    return precedes(a, b);
+}
+
+template <class Precedes>
+std::size_t LoserTree<Precedes>::play(std::size_t node) {
+    if (node >= leaves) return node - leaves;
+    std::size_t a = play(2 * node);
+    std::size_t b = play(2 * node + 1);
+    if (wins(a, b)) {
+        losers[node] = b;
+        return a;
+    }
+    losers[node] = a;
+    return b;
+}
+
+template <class Precedes>
+void LoserTree<Precedes>::replay() {
+    std::size_t winner = losers[0];
+    for (std::size_t node = (winner + leaves) / 2; node != 0; node /= 2) {
+        if (wins(losers[node], winner)) std::swap(losers[node], winner);
+    }
+    losers[0] = winner;
+}
+
+inline Ranking::Ranking(const allocator_type& allocator)
+    : nodes(allocator),
+      free_nodes(allocator),
+      buckets(allocator),
+      pending(allocator),
+      handles(allocator),
+      free_handles(allocator) {}
+
+inline Ranking::Ranking(const Ranking& other, const allocator_type& allocator)
+    : Ranking(allocator) {
+    *this = other;
+}
+
+// Settles the source first, so a copy never races with another reader
+// settling it and never carries pending insertions over.
+inline Ranking& Ranking::operator=(const Ranking& other) {
+    if (this == &other) return *this;
+    other.settle();
+    nodes = other.nodes;
+    free_nodes = other.free_nodes;
+    buckets = other.buckets;
+    pending.clear();
+    handles = other.handles;
+    free_handles = other.free_handles;
+    root = other.root;
+    next_order = other.next_order;
+    priority_state = other.priority_state;
+    lineage = other.lineage;
+    settle_state.unsettled.store(false, std::memory_order_relaxed);
+    return *this;
+}
+
+inline Ranking::Ranking(Ranking&& other, const allocator_type& allocator)
+    : Ranking(allocator) {
+    *this = std::move(other);
+}
+
+// Pending insertions move over unsettled, in the source's resource.
+inline Ranking::Ranking(Ranking&& other) noexcept
+    : nodes(std::move(other.nodes)),
+      free_nodes(std::move(other.free_nodes)),
+      buckets(std::move(other.buckets)),
+      pending(std::move(other.pending)),
+      handles(std::move(other.handles)),
+      free_handles(std::move(other.free_handles)),
+      root(std::exchange(other.root, NIL)),
+      next_order(std::exchange(other.next_order, 0)),
+      priority_state(std::exchange(other.priority_state, 0)),
+      lineage(std::exchange(other.lineage, next_lineage())),
+      settle_state(other.settle_state) {
+    other.nodes.clear();
+    other.free_nodes.clear();
+    other.buckets.clear();
+    other.pending.clear();
+    other.handles.clear();
+    other.free_handles.clear();
+    other.settle_state.unsettled.store(false, std::memory_order_relaxed);
+}
+
+// Between different resources the nodes have to be copied over.
+inline Ranking& Ranking::operator=(Ranking&& other) {
+    if (this != &other && get_allocator() != other.get_allocator()) {
+        *this = other;
+    } else if (this != &other) {
+        nodes = std::move(other.nodes);
+        free_nodes = std::move(other.free_nodes);
+        buckets = std::move(other.buckets);
+        pending = std::move(other.pending);
+        handles = std::move(other.handles);
+        free_handles = std::move(other.free_handles);
+        root = std::exchange(other.root, NIL);
+        next_order = std::exchange(other.next_order, 0);
+        priority_state = std::exchange(other.priority_state, 0);
+        lineage = std::exchange(other.lineage, next_lineage());
+        settle_state = other.settle_state;
+        other.nodes.clear();
+        other.free_nodes.clear();
+        other.buckets.clear();
+        other.pending.clear();
+        other.handles.clear();
+        other.free_handles.clear();
+    }
+    return *this;
+}
+
+inline Ranking::Ranking(const std::initializer_list<Picker>& pickers_list)
+    : Ranking(std::span<const Picker>(pickers_list.begin(),
+                                      pickers_list.size())) {}
+
+template <std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>,
+                                 const Picker&>
+Ranking::Ranking(R&& pickers, std::size_t threads, BuildMode mode,
+                 const allocator_type& allocator)
+    : Ranking(allocator) {
+    FRUIT_STATS_TIME(RANKING_BUILD);
+    constexpr bool steal = !std::is_lvalue_reference_v<R> &&
+                           !std::ranges::view<std::remove_cvref_t<R>> &&
+                           !std::ranges::borrowed_range<R>;
+    NodeVector unsorted(allocator);
+    if constexpr (std::ranges::sized_range<R>) {
+        unsorted.reserve(std::ranges::size(pickers));
+    }
+    for (auto&& picker : pickers) {
+        if constexpr (steal) {
+            unsorted.push_back(Node(Picker(std::move(picker), allocator)));
+        } else {
+            unsorted.push_back(Node(Picker(picker, allocator)));
+        }
+        unsorted.back().fingerprint = unsorted.back().picker.fingerprint();
+    }
+    assign_unsorted(std::move(unsorted), threads, mode);
+}
+
+inline bool Ranking::precedes(NodeIndex a, NodeIndex b) const {
+    auto cmp = nodes[a].picker <=> nodes[b].picker;
+    return cmp < 0 || (cmp == 0 && nodes[a].order < nodes[b].order);
+}
+
+inline void Ranking::refresh(NodeIndex t) {
+    nodes[t].subtree = static_cast<std::uint32_t>(
+        1 + subtree_size(nodes[t].left) + subtree_size(nodes[t].right));
+}
+
+// Splits `t` into the nodes that precede `key` and the rest.
+inline std::pair<Ranking::NodeIndex, Ranking::NodeIndex> Ranking::split(
+    NodeIndex t, NodeIndex key) {
+    if (t == NIL) return {NIL, NIL};
+    if (precedes(t, key)) {
+        auto [left, right] = split(nodes[t].right, key);
+        nodes[t].right = left;
+        refresh(t);
+        return {t, right};
+    }
+    auto [left, right] = split(nodes[t].left, key);
+    nodes[t].left = right;
+    refresh(t);
+    return {left, t};
+}
+
+// Joins two treaps where every node of `a` precedes every node of `b`.
+inline Ranking::NodeIndex Ranking::join(NodeIndex a, NodeIndex b) {
+    if (a == NIL) return b;
+    if (b == NIL) return a;
+    if (nodes[a].priority > nodes[b].priority) {
+        nodes[a].right = join(nodes[a].right, b);
+        refresh(a);
+        return a;
+    }
+    nodes[b].left = join(a, nodes[b].left);
+    refresh(b);
+    return b;
+}
+
+inline Ranking::NodeIndex Ranking::unlink(NodeIndex t, NodeIndex key) {
+    if (t == key) return join(nodes[t].left, nodes[t].right);
+    if (precedes(key, t)) {
+        nodes[t].left = unlink(nodes[t].left, key);
+    } else {
+        nodes[t].right = unlink(nodes[t].right, key);
+    }
+    refresh(t);
+    return t;
+}
+
+// splitmix64: cheap, deterministic and well spread treap priorities.
+inline std::uint64_t Ranking::next_priority() {
+    std::uint64_t z = (priority_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline Ranking::NodeIndex Ranking::allocate(const Picker& picker) {
+    Node node(Picker(picker, get_allocator()), next_order++, next_priority(),
+              picker.fingerprint());
+
+    NodeIndex slot;
+    if (!free_nodes.empty()) {
+        slot = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[slot] = std::move(node);
+    } else {
+        slot = static_cast<NodeIndex>(nodes.size());
+        nodes.push_back(std::move(node));
+    }
+    link_bucket(slot);
+    return slot;
+}
 
-    auto it1 = pickers.begin();
-    auto it2 = other.pickers.begin();
+inline void Ranking::insert(NodeIndex node) {
+    auto [left, right] = split(root, node);
+    root = join(join(left, node), right);
+}
 
-    while (it1 != pickers.end() && it2 != other.pickers.end()) {
-        if (*it2 < *it1) {
-            merged.push_back(*it2++);
+inline void Ranking::erase(NodeIndex node) {
+    root = unlink(root, node);
+    unlink_bucket(node);
+    if (std::uint32_t id = nodes[node].handle; id != NIL) {
+        handles[id] = {NIL, handles[id].generation + 1};
+        free_handles.push_back(id);
+    }
+    nodes[node] = Node(get_allocator());
+    free_nodes.push_back(node);
+}
+
+inline Ranking::NodeIndex Ranking::node_at(std::size_t rank) const {
+    NodeIndex t = root;
+    while (true) {
+        std::size_t left = subtree_size(nodes[t].left);
+        if (rank < left) {
+            t = nodes[t].left;
+        } else if (rank == left) {
+            return t;
         } else {
-            merged.push_back(*it1++);
+            rank -= left + 1;
+            t = nodes[t].right;
         }
     }
+}
 
-    merged.insert(merged.end(), it1, pickers.end());
-    merged.insert(merged.end(), it2, other.pickers.end());
+inline Ranking::NodeIndex Ranking::node_of(Handle handle) const {
+    if (!contains(handle)) {
+        throw std::out_of_range("Ranking handle is stale");
+    }
+    return handles[handle.id].node;
+}
 
-    pickers = std::move(merged);
+// The first `limit` nodes in ranking order.
+inline std::vector<Ranking::NodeIndex> Ranking::in_order(
+    std::size_t limit) const {
+    std::vector<NodeIndex> result;
+    result.reserve(std::min(limit, subtree_size(root)));
+    std::vector<NodeIndex> stack;
+    stack.reserve(64);  // the expected depth is far below this
+    NodeIndex t = root;
+    while ((t != NIL || !stack.empty()) && result.size() < limit) {
+        while (t != NIL) {
+            stack.push_back(t);
+            t = nodes[t].left;
+        }
+        t = stack.back();
+        stack.pop_back();
+        result.push_back(t);
+        t = nodes[t].right;
+    }
+    return result;
+}
+
+// Replaces the contents with `sorted`, already in ranking order, and builds
+// the treap in O(n) as a Cartesian tree over freshly drawn priorities. The
+// nodes' old priorities may repeat across the rankings they came from.
+inline void Ranking::assign_sorted(NodeVector&& sorted) {
+    nodes = std::move(sorted);
+    free_nodes.clear();
+    pending.clear();
+    next_order = nodes.size();
+
+    buckets.assign(std::bit_ceil(std::max(nodes.size(), std::size_t(16))),
+                   NIL);
+    for (NodeIndex i = 0; i < nodes.size(); ++i) link_bucket(i);
+
+    std::vector<NodeIndex> spine;
+    spine.reserve(nodes.size());
+    for (NodeIndex i = 0; i < nodes.size(); ++i) {
+        Node& node = nodes[i];
+        node.order = i;
+        node.priority = next_priority();
+        node.left = node.right = NIL;
+        if (node.handle != NIL) handles[node.handle].node = i;
+
+        NodeIndex last = NIL;
+        while (!spine.empty() && nodes[spine.back()].priority < node.priority) {
+            last = spine.back();
+            spine.pop_back();
+        }
+        node.left = last;
+        if (!spine.empty()) nodes[spine.back()].right = i;
+        spine.push_back(i);
+    }
+    root = spine.empty() ? NIL : spine.front();
+    build_subtree_sizes(root);
+}
+
+inline std::uint32_t Ranking::build_subtree_sizes(NodeIndex t) {
+    if (t == NIL) return 0;
+    nodes[t].subtree = 1 + build_subtree_sizes(nodes[t].left) +
+                       build_subtree_sizes(nodes[t].right);
+    return nodes[t].subtree;
+}
+
+// Fibonacci hashing spreads the fingerprint over the top bits.
+inline std::size_t Ranking::bucket_of(std::uint64_t fingerprint) const {
+    const int bits = std::countr_zero(buckets.size());
+    return static_cast<std::size_t>((fingerprint * 0x9e3779b97f4a7c15ULL) >>
+                                    (64 - bits));
+}
+
+// Keeps at least as many buckets as nodes, free ones included.
+inline void Ranking::link_bucket(NodeIndex node) {
+    if (nodes.size() > buckets.size()) {
+        rehash(std::max(buckets.size() * 2, std::size_t(16)));
+    }
+    NodeIndex& head = buckets[bucket_of(nodes[node].fingerprint)];
+    nodes[node].next_in_bucket = head;
+    head = node;
+}
+
+inline void Ranking::unlink_bucket(NodeIndex node) {
+    NodeIndex* link = &buckets[bucket_of(nodes[node].fingerprint)];
+    while (*link != node) link = &nodes[*link].next_in_bucket;
+    *link = nodes[node].next_in_bucket;
+}
+
+inline void Ranking::rehash(std::size_t bucket_count) {
+    std::pmr::vector<NodeIndex> old = std::exchange(
+        buckets, std::pmr::vector<NodeIndex>(bucket_count, NIL,
+                                             get_allocator()));
+    for (NodeIndex head : old) {
+        while (head != NIL) {
+            NodeIndex next = nodes[head].next_in_bucket;
+            NodeIndex& bucket = buckets[bucket_of(nodes[head].fingerprint)];
+            nodes[head].next_in_bucket = bucket;
+            bucket = head;
+            head = next;
+        }
+    }
+}
+
+inline Ranking& Ranking::operator+=(const Picker& picker) {
+    pending.push_back(allocate(picker));
+    settle_state.unsettled.store(true, std::memory_order_relaxed);
+    return *this;
+}
+
+// Settling is logically const: it changes the layout, not the value.
+// Concurrent readers all wait for the first one to finish it.
+inline void Ranking::settle() const {
+    if (!settle_state.unsettled.load(std::memory_order_acquire)) return;
+    std::lock_guard lock(settle_state.mutex);
+    if (!pending.empty()) const_cast<Ranking*>(this)->settle_pending();
+    settle_state.unsettled.store(false, std::memory_order_release);
+}
+
+// A few insertions go into the tree one by one in O(m log n). Past about
+// n / log n of them it is cheaper to rebuild: the ranked nodes followed by
+// the pending ones go through the bulk constructor's radix sort, which keeps
+// equal keys in that order, so ties still rank in insertion order.
+inline void Ranking::settle_pending() {
+    FRUIT_STATS_TIME(RANKING_SETTLE);
+    const std::size_t ranked = subtree_size(root);
+    if (pending.size() * (std::bit_width(ranked) + 1) <= ranked) {
+        for (NodeIndex node : pending) insert(node);
+        pending.clear();
+        return;
+    }
+
+    NodeVector all(get_allocator());
+    all.reserve(ranked + pending.size());
+    for (NodeIndex node : in_order()) all.push_back(std::move(nodes[node]));
+    for (NodeIndex node : pending) all.push_back(std::move(nodes[node]));
+    assign_unsorted(std::move(all), 0, BuildMode::RADIX);
+}
+
+inline Ranking::Handle Ranking::add(const Picker& picker) {
+    const NodeIndex node = allocate(picker);
+    pending.push_back(node);
+    settle_state.unsettled.store(true, std::memory_order_relaxed);
+
+    std::uint32_t id;
+    if (!free_handles.empty()) {
+        id = free_handles.back();
+        free_handles.pop_back();
+        handles[id].node = node;
+    } else {
+        id = static_cast<std::uint32_t>(handles.size());
+        handles.push_back({node, 0});
+    }
+    nodes[node].handle = id;
+    return Handle{lineage, id, handles[id].generation};
+}
+
+// Unlinks the node while its old picker still orders it, then reinserts it
+// with a fresh insertion order, exactly like removing and re-adding it.
+inline void Ranking::update(Handle handle, const Picker& picker) {
+    settle();
+    const NodeIndex node = node_of(handle);
+    root = unlink(root, node);
+    unlink_bucket(node);
+
+    Node& entry = nodes[node];
+    entry.picker = picker;
+    entry.fingerprint = picker.fingerprint();
+    entry.order = next_order++;
+    entry.left = entry.right = NIL;
+    entry.subtree = 1;
+    link_bucket(node);
+    insert(node);
+}
+
+inline void Ranking::remove(Handle handle) {
+    settle();
+    erase(node_of(handle));
+}
+
+inline bool Ranking::contains(Handle handle) const {
+    settle();
+    return handle.lineage == lineage && handle.id < handles.size() &&
+           handles[handle.id].generation == handle.generation &&
+           handles[handle.id].node != NIL;
+}
+
+inline const Picker& Ranking::at(Handle handle) const {
+    settle();
+    return nodes[node_of(handle)].picker;
+}
+
+// Walks down from the root, counting every node that precedes the entry.
+inline std::size_t Ranking::rank_of(Handle handle) const {
+    settle();
+    const NodeIndex node = node_of(handle);
+    std::size_t rank = 0;
+    NodeIndex t = root;
+    while (t != node) {
+        if (precedes(node, t)) {
+            t = nodes[t].left;
+        } else {
+            rank += subtree_size(nodes[t].left) + 1;
+            t = nodes[t].right;
+        }
+    }
+    return rank + subtree_size(nodes[node].left);
+}
+
+inline Ranking& Ranking::operator+=(Ranking&& other) {
+    if (&other == this) return *this;
+    merge_in(std::move(other));
+    other = Ranking{};
+    return *this;
+}
+
+inline const Picker& Ranking::operator[](std::size_t index) const {
+    settle();
+    if (root == NIL) {
+        throw std::out_of_range("Ranking is empty");
+    }
+    if (index >= count_pickers()) {
+        index = count_pickers() - 1;
+    }
+    return nodes[node_at(index)].picker;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Ranking& ranking) {
+    ranking.settle();
+    if (ranking.root == Ranking::NIL) return os;
+
+    auto order = ranking.in_order();
+    os << ranking.nodes[order[0]].picker;
+
+    for (size_t i = 1; i < order.size(); ++i) {
+        os << "\n" << ranking.nodes[order[i]].picker;
+    }
+
+    os << "\n";
+    return os;
+}
+
+inline std::vector<Picker> Ranking::top(std::size_t k) const {
+    settle();
+    std::vector<Picker> result;
+    for (NodeIndex t : in_order(k)) result.push_back(nodes[t].picker);
+    return result;
+}
+
+template <class Visit>
+void Ranking::for_each(Visit&& visit) const {
+    settle();
+    visit_in_order(root, visit);
+}
+
+// Recursion depth is the treap height, O(log n) expected.
+template <class Visit>
+void Ranking::visit_in_order(NodeIndex t, Visit& visit) const {
+    if (t == NIL) return;
+    visit_in_order(nodes[t].left, visit);
+    visit(std::as_const(nodes[t].picker));
+    visit_in_order(nodes[t].right, visit);
+}
+
+// Equal pickers have equal fingerprints, so only the nodes in the bucket of
+// `picker`'s fingerprint need a deep comparison. Of several equal pickers
+// the earliest added one is removed.
+inline Ranking& Ranking::operator-=(const Picker& picker) {
+    FRUIT_STATS_TIME(RANKING_REMOVE);
+    settle();
+    if (buckets.empty()) return *this;
+
+    const std::uint64_t fingerprint = picker.fingerprint();
+    NodeIndex target = NIL;
+    for (NodeIndex t = buckets[bucket_of(fingerprint)]; t != NIL;
+         t = nodes[t].next_in_bucket) {
+        if (nodes[t].fingerprint == fingerprint &&
+            (target == NIL || nodes[t].order < nodes[target].order) &&
+            nodes[t].picker == picker) {
+            target = t;
+        }
+    }
+    if (target != NIL) erase(target);
     return *this;
 }
 
+inline Ranking& Ranking::operator+=(const Ranking& other) {
+    if (&other == this) {
+        Ranking copy(other);
+        merge_in(std::move(copy));
+    } else {
+        merge_in(other);
+    }
+    return *this;
+}
+
+// Stable merge of two sorted sequences; on ties our pickers go first. Our
+// own nodes are always moved, the other ranking's only when it is an rvalue.
+template <class Other>
+void Ranking::merge_in(Other&& other) {
+    FRUIT_STATS_TIME(RANKING_MERGE);
+    settle();
+    other.settle();
+    auto mine = in_order();
+    auto theirs = other.in_order();
+
+    NodeVector merged(get_allocator());
+    merged.reserve(mine.size() + theirs.size());
+
+    auto take_theirs = [&](NodeIndex t) {
+        if constexpr (std::is_rvalue_reference_v<Other&&>) {
+            merged.push_back(std::move(other.nodes[t]));
+        } else {
+            merged.push_back(other.nodes[t]);
+        }
+        merged.back().handle = NIL;
+    };
+
+    auto it1 = mine.begin();
+    auto it2 = theirs.begin();
+
+    while (it1 != mine.end() && it2 != theirs.end()) {
+        if (other.nodes[*it2].picker < nodes[*it1].picker) {
+            take_theirs(*it2++);
+        } else {
+            merged.push_back(std::move(nodes[*it1++]));
+        }
+    }
+
+    for (; it1 != mine.end(); ++it1) merged.push_back(std::move(nodes[*it1]));
+    for (; it2 != theirs.end(); ++it2) take_theirs(*it2);
+
+    assign_sorted(std::move(merged));
+}
+
 inline Ranking Ranking::operator+(const Ranking& other) const {
     Ranking result(*this);
     result += other;
     return result;
 }
 
+inline Ranking Ranking::merge_all(std::span<const Ranking> rankings,
+                                  std::size_t threads) {
+    return merge_sources(rankings, threads);
+}
+
+inline Ranking Ranking::merge_all(std::vector<Ranking>&& rankings,
+                                  std::size_t threads) {
+    Ranking result = merge_sources(std::span<Ranking>(rankings), threads);
+    for (Ranking& ranking : rankings) ranking = Ranking{};
+    return result;
+}
+
+// Workers for a parallel pass over `items`: `threads`, or one per hardware
+// thread when it is 0, but never so many that a worker gets little work.
+inline std::size_t Ranking::worker_count(std::size_t items,
+                                         std::size_t threads) {
+    constexpr std::size_t MIN_ITEMS_PER_WORKER = std::size_t(1) << 13;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return std::clamp<std::size_t>(items / MIN_ITEMS_PER_WORKER, 1, threads);
+}
+
+inline std::size_t Ranking::allocating_workers(
+    std::size_t workers, const allocator_type& allocator) {
+    return allocator.resource() == std::pmr::new_delete_resource() ? workers
+                                                                   : 1;
+}
+
+// Calls work(0) .. work(workers - 1), all but the first on their own thread,
+// and rethrows the first exception any of them threw.
+template <class Work>
+void Ranking::run_workers(std::size_t workers, Work&& work) {
+    if (workers == 1) {
+        work(std::size_t(0));
+        return;
+    }
+    std::vector<std::exception_ptr> errors(workers);
+    auto guarded = [&](std::size_t t) {
+        try {
+            work(t);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(workers - 1);
+        for (std::size_t t = 1; t < workers; ++t) pool.emplace_back(guarded, t);
+        guarded(0);
+    }
+    for (const auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+// Sorted runs can be merged in parallel by cutting the output at splitter
+// elements: each run contributes its elements that precede the splitter.
+// Splitters are quantiles of a sample taken evenly over all runs; every
+// worker then runs its own loser tree over its slice of each run.
+template <class Precedes, class Emit>
+void Ranking::merge_runs(const std::vector<std::size_t>& run_sizes,
+                         Precedes precedes, Emit emit, std::size_t workers) {
+    const std::size_t k = run_sizes.size();
+    std::size_t total = 0;
+    for (std::size_t size : run_sizes) total += size;
+
+    // cuts[t][j] is the first position of run j that worker t merges.
+    std::vector<std::vector<std::size_t>> cuts(workers + 1,
+                                               std::vector<std::size_t>(k));
+    cuts[workers] = run_sizes;
+
+    if (workers > 1) {
+        const std::size_t stride =
+            std::max<std::size_t>(total / workers / 64, 1);
+        std::vector<std::pair<std::size_t, std::size_t>> samples;
+        for (std::size_t j = 0; j < k; ++j) {
+            for (std::size_t p = 0; p < run_sizes[j]; p += stride) {
+                samples.emplace_back(j, p);
+            }
+        }
+        std::sort(samples.begin(), samples.end(),
+                  [&](const auto& a, const auto& b) {
+                      return precedes(a.first, a.second, b.first, b.second);
+                  });
+        for (std::size_t t = 1; t < workers; ++t) {
+            auto [sj, sp] = samples[samples.size() * t / workers];
+            for (std::size_t j = 0; j < k; ++j) {
+                if (j == sj) {
+                    cuts[t][j] = sp;
+                    continue;
+                }
+                std::size_t low = 0, high = run_sizes[j];
+                while (low < high) {
+                    std::size_t mid = low + (high - low) / 2;
+                    if (precedes(j, mid, sj, sp)) {
+                        low = mid + 1;
+                    } else {
+                        high = mid;
+                    }
+                }
+                cuts[t][j] = low;
+            }
+        }
+    }
+
+    std::vector<std::size_t> offsets(workers + 1);
+    for (std::size_t t = 0; t <= workers; ++t) {
+        for (std::size_t j = 0; j < k; ++j) offsets[t] += cuts[t][j];
+    }
+
+    run_workers(workers, [&](std::size_t t) {
+        std::vector<std::size_t> cursor = cuts[t];
+        const std::vector<std::size_t>& end = cuts[t + 1];
+        LoserTree tree(k, [&](std::size_t a, std::size_t b) {
+            if (cursor[a] == end[a]) return false;
+            if (cursor[b] == end[b]) return true;
+            return precedes(a, cursor[a], b, cursor[b]);
+        });
+        for (std::size_t out = offsets[t]; out < offsets[t + 1]; ++out) {
+            std::size_t j = tree.winner();
+            emit(out, j, cursor[j]++);
+            tree.replay();
+        }
+    });
+}
+
+// Merge order is (picker, source, position), which keeps ties in source
+// order like repeated operator+=. The workers merge positions only; the
+// nodes are copied afterwards, as copies allocate from the result's
+// resource.
+template <class Source>
+Ranking Ranking::merge_sources(std::span<Source> sources, std::size_t threads) {
+    FRUIT_STATS_TIME(RANKING_MERGE);
+    std::vector<std::vector<NodeIndex>> orders;
+    orders.reserve(sources.size());
+    std::vector<std::size_t> run_sizes;
+    run_sizes.reserve(sources.size());
+    for (const Ranking& source : sources) {
+        source.settle();
+        orders.push_back(source.in_order());
+        run_sizes.push_back(orders.back().size());
+    }
+
+    auto node_of = [&](std::size_t j, std::size_t p) -> auto& {
+        return sources[j].nodes[orders[j][p]];
+    };
+    auto precedes = [&](std::size_t j, std::size_t p, std::size_t i,
+                        std::size_t q) {
+        auto cmp = node_of(j, p).picker <=> node_of(i, q).picker;
+        if (cmp != 0) return cmp < 0;
+        return j != i ? j < i : p < q;
+    };
+
+    std::size_t total = 0;
+    for (std::size_t size : run_sizes) total += size;
+    struct Position {
+        std::uint32_t source;
+        NodeIndex index;  // into the source's in-order list
+    };
+    std::vector<Position> positions(total);
+    const std::size_t workers = worker_count(total, threads);
+    merge_runs(
+        run_sizes, precedes,
+        [&](std::size_t out, std::size_t j, std::size_t p) {
+            positions[out] = {static_cast<std::uint32_t>(j),
+                              static_cast<NodeIndex>(p)};
+        },
+        workers);
+
+    const allocator_type allocator =
+        sources.empty() ? allocator_type{} : sources.front().get_allocator();
+    NodeVector merged(total, allocator);
+    const std::size_t copiers = allocating_workers(workers, allocator);
+    run_workers(copiers, [&](std::size_t t) {
+        for (std::size_t out = total * t / copiers;
+             out < total * (t + 1) / copiers; ++out) {
+            auto& node = node_of(positions[out].source, positions[out].index);
+            if constexpr (std::is_const_v<Source>) {
+                merged[out] = node;
+            } else {
+                merged[out] = std::move(node);
+            }
+            merged[out].handle = NIL;
+        }
+    });
+
+    Ranking result(allocator);
+    result.assign_sorted(std::move(merged));
+    return result;
+}
+
+// Sorts compact (key, insertion index) entries instead of the nodes, with
+// the work split into one chunk per worker. Either sort keeps equal keys in
+// insertion order. The nodes are then permuted in place along the
+// permutation's cycles, moving each node once; a second node array would
+// cost more in fresh pages than it saves.
+inline void Ranking::assign_unsorted(NodeVector&& unsorted,
+                                     std::size_t threads, BuildMode mode) {
+    const std::size_t n = unsorted.size();
+    const std::size_t workers = worker_count(n, threads);
+    std::vector<std::size_t> bounds(workers + 1);
+    for (std::size_t t = 0; t <= workers; ++t) bounds[t] = n * t / workers;
+
+    FRUIT_STATS_ADD(RANKING_SORTS, 1);
+    FRUIT_STATS_ADD(RANKING_SORTED_PICKERS, n);
+    std::vector<SortEntry> entries(n);
+    run_workers(workers, [&](std::size_t t) {
+        for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+            entries[i] = {unsorted[i].picker.rank_key(),
+                          static_cast<NodeIndex>(i)};
+        }
+    });
+    if (mode == BuildMode::RADIX) {
+        radix_sort(entries, bounds);
+    } else {
+        comparison_sort(entries, bounds);
+    }
+
+    // Entries that are done point at their own slot.
+    for (std::size_t start = 0; start < n; ++start) {
+        if (entries[start].index == start) continue;
+        Node carried = std::move(unsorted[start]);
+        std::size_t slot = start;
+        while (entries[slot].index != start) {
+            std::size_t from = std::exchange(entries[slot].index,
+                                             static_cast<NodeIndex>(slot));
+            unsorted[slot] = std::move(unsorted[from]);
+            slot = from;
+        }
+        entries[slot].index = static_cast<NodeIndex>(slot);
+        unsorted[slot] = std::move(carried);
+    }
+    assign_sorted(std::move(unsorted));
+}
+
+// Each worker sorts its chunk; the index breaks ties, so the chunks can be
+// sorted unstably and then merged in parallel.
+inline void Ranking::comparison_sort(std::vector<SortEntry>& entries,
+                                     const std::vector<std::size_t>& bounds) {
+    auto before = [](const SortEntry& a, const SortEntry& b) {
+        return a.key > b.key || (a.key == b.key && a.index < b.index);
+    };
+    const std::size_t workers = bounds.size() - 1;
+    run_workers(workers, [&](std::size_t t) {
+        std::sort(entries.begin() + bounds[t], entries.begin() + bounds[t + 1],
+                  before);
+    });
+    if (workers == 1) return;
+
+    std::vector<std::size_t> run_sizes(workers);
+    for (std::size_t t = 0; t < workers; ++t) {
+        run_sizes[t] = bounds[t + 1] - bounds[t];
+    }
+    std::vector<SortEntry> merged(entries.size());
+    merge_runs(
+        run_sizes,
+        [&](std::size_t j, std::size_t p, std::size_t i, std::size_t q) {
+            return before(entries[bounds[j] + p], entries[bounds[i] + q]);
+        },
+        [&](std::size_t out, std::size_t j, std::size_t p) {
+            merged[out] = entries[bounds[j] + p];
+        },
+        workers);
+    entries = std::move(merged);
+}
+
+// Stable LSD radix sort, one byte digit per pass from the least significant.
+// Each pass counts digits per worker chunk, then every worker scatters its
+// chunk from its own offsets. A pass whose digit is the same everywhere is
+// skipped after counting.
+template <class Entry, class Digit>
+void Ranking::lsd_radix_sort(std::vector<Entry>& entries,
+                             const std::vector<std::size_t>& bounds,
+                             std::size_t digits, Digit digit) {
+    constexpr std::size_t RADIX = 256;
+    const std::size_t workers = bounds.size() - 1;
+    std::vector<Entry> buffer(entries.size());
+    std::vector<std::array<std::size_t, RADIX>> offsets(workers);
+
+    for (std::size_t d = 0; d < digits; ++d) {
+        run_workers(workers, [&](std::size_t t) {
+            offsets[t].fill(0);
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+                ++offsets[t][digit(entries[i], d)];
+            }
+        });
+        bool constant = false;
+        std::size_t next = 0;
+        for (std::size_t b = 0; b < RADIX; ++b) {
+            const std::size_t first = next;
+            for (std::size_t t = 0; t < workers; ++t) {
+                next += std::exchange(offsets[t][b], next);
+            }
+            constant = constant || next - first == entries.size();
+        }
+        if (constant) continue;
+
+        run_workers(workers, [&](std::size_t t) {
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+                buffer[offsets[t][digit(entries[i], d)]++] = entries[i];
+            }
+        });
+        entries.swap(buffer);
+    }
+}
+
+// The six criteria are five counts (see RankKey), concatenated most
+// significant first. Each count only needs as many bits as the largest value
+// it takes in this batch, so the key usually fits one 64-bit word and the
+// sort takes two or three passes over 16-byte entries. Otherwise the full
+// RankKey is sorted, again one pass per byte the counts of the batch use.
+// Keys are complemented so the best picker comes first; the entries start in
+// insertion order, so stability alone keeps ties in that order.
+inline void Ranking::radix_sort(std::vector<SortEntry>& entries,
+                                const std::vector<std::size_t>& bounds) {
+    constexpr std::size_t FIELDS = RankKey::FIELDS;
+    RankKey::Counts widest{};
+    for (const SortEntry& entry : entries) {
+        RankKey::Counts c = entry.key.counts();
+        for (std::size_t i = 0; i < FIELDS; ++i) widest[i] |= c[i];
+    }
+    std::array<int, FIELDS> widths{};
+    int bits = 0;
+    for (std::size_t i = 0; i < FIELDS; ++i) {
+        widths[i] = std::bit_width(widest[i]);
+        bits += widths[i];
+    }
+
+    if (bits <= 64) {
+        struct PackedEntry {
+            std::uint64_t key;
+            NodeIndex index;
+        };
+        const std::uint64_t mask =
+            bits == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+        std::vector<PackedEntry> packed(entries.size());
+        run_workers(bounds.size() - 1, [&](std::size_t t) {
+            for (std::size_t i = bounds[t]; i < bounds[t + 1]; ++i) {
+                RankKey::Counts c = entries[i].key.counts();
+                std::uint64_t key = 0;
+                for (std::size_t f = 0; f < FIELDS; ++f) {
+                    // A 64-bit wide count is the only nonzero one.
+                    key = widths[f] < 64 ? (key << widths[f]) | c[f] : c[f];
+                }
+                packed[i] = {mask ^ key, entries[i].index};
+            }
+        });
+        lsd_radix_sort(packed, bounds, (bits + 7) / 8,
+                       [](const PackedEntry& e, std::size_t d) {
+                           return static_cast<std::size_t>(e.key >> (8 * d)) &
+                                  0xff;
+                       });
+        // Only the order of the indices is used from here on.
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            entries[i].index = packed[i].index;
+        }
+        return;
+    }
+
+    // The bytes in use, least significant first, as (field, shift) pairs.
+    std::vector<std::pair<std::size_t, int>> digits;
+    for (std::size_t f = FIELDS; f-- > 0;) {
+        for (int shift = 0; shift < widths[f]; shift += 8) {
+            digits.emplace_back(f, shift);
+        }
+    }
+    lsd_radix_sort(entries, bounds, digits.size(),
+                   [&digits](const SortEntry& e, std::size_t d) {
+                       const auto [field, shift] = digits[d];
+                       return 0xff - (static_cast<std::size_t>(
+                                          e.key.counts()[field] >> shift) &
+                                      0xff);
+                   });
+}
+
+inline bool TopKRanking::ranks_before(const Entry& a, const Entry& b) {
+    auto cmp = a.picker <=> b.picker;
+    return cmp < 0 || (cmp == 0 && a.order < b.order);
+}
+
+// A newcomer loses ties, having been added last.
+inline bool TopKRanking::admits(const Picker& picker) const {
+    if (heap.size() < k) return true;
+    return !heap.empty() && picker < heap.front().picker;
+}
+
+// With ranks_before as the heap order, the front is the worst kept entry.
+template <class P>
+void TopKRanking::add(P&& picker) {
+    const std::uint64_t order = next_order++;
+    if (!admits(picker)) return;
+    if (heap.size() == k) {
+        std::pop_heap(heap.begin(), heap.end(), ranks_before);
+        heap.back() = Entry{std::forward<P>(picker), order};
+    } else {
+        heap.push_back(Entry{std::forward<P>(picker), order});
+    }
+    std::push_heap(heap.begin(), heap.end(), ranks_before);
+}
+
+inline TopKRanking& TopKRanking::operator+=(const Picker& picker) {
+    add(picker);
+    return *this;
+}
+
+inline TopKRanking& TopKRanking::operator+=(Picker&& picker) {
+    add(std::move(picker));
+    return *this;
+}
+
+inline std::vector<Picker> TopKRanking::top() const {
+    std::vector<const Entry*> sorted;
+    sorted.reserve(heap.size());
+    for (const Entry& entry : heap) sorted.push_back(&entry);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const Entry* a, const Entry* b) {
+                  return ranks_before(*a, *b);
+              });
+
+    std::vector<Picker> result;
+    result.reserve(sorted.size());
+    for (const Entry* entry : sorted) result.push_back(entry->picker);
+    return result;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const TopKRanking& ranking) {
+    auto pickers = ranking.top();
+    for (std::size_t i = 0; i < pickers.size(); ++i) {
+        os << (i ? "\n" : "") << pickers[i];
+    }
+    if (!pickers.empty()) os << "\n";
+    return os;
+}
+
 constexpr Fruit YUMMY_ONE{Taste::SWEET, Size::LARGE, Quality::HEALTHY};
 constexpr Fruit ROTTY_ONE{Taste::SOUR, Size::SMALL, Quality::ROTTEN};
 
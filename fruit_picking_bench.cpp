@@ -0,0 +1,709 @@
+// Benchmarks for fruit_picking.h
+// Build and run: make bench
+//
+// Usage: benchmarks [RESULTS_CSV [FILTER]]
+// Every result is printed and also written to RESULTS_CSV (default
+// bench_results.csv) as a "benchmark,value,unit" row, so the files of two
+// builds can be diffed. FILTER runs only the groups whose name contains it.
+
+#include "fruit_picking.h"
+#include "fruit_picking_events.h"
+#include "fruit_picking_format.h"
+#include "fruit_picking_parse.h"
+#include "fruit_picking_snapshot.h"
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+volatile std::size_t sink;
+
+struct Result {
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+std::vector<Result> results;
+
+template <class... Args>
+std::string label(const char* format, Args... args) {
+    char buffer[128];
+    std::snprintf(buffer, sizeof buffer, format, args...);
+    return buffer;
+}
+
+// `baseline`, if given, is the time of the approach this result replaces;
+// the speedup is printed but not recorded, as it follows from both rows.
+void report(const std::string& name, double value, const char* unit,
+            double baseline = 0) {
+    results.push_back({name, value, unit});
+    std::printf("%-48s %10.3f %s", name.c_str(), value, unit);
+    if (baseline > 0) std::printf("  (%.1fx)", baseline / value);
+    std::printf("\n");
+}
+
+bool write_results(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    out << "benchmark,value,unit\n";
+    for (const Result& r : results) {
+        out << r.name << ',' << r.value << ',' << r.unit << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+std::size_t total(const fruit_kernels::SizeCounts& counts) {
+    return counts[0] + counts[1] + counts[2];
+}
+
+// Runs `body` `repeats` times on a fresh copy of `input` and returns the best
+// time per fruit, so cold caches and page faults do not skew the result.
+template <class Body>
+double best_ns_per_fruit(const std::vector<Fruit>& input, int repeats,
+                         Body&& body) {
+    double best = 1e300;
+    std::vector<Fruit> work;
+    for (int r = 0; r < repeats; ++r) {
+        work = input;
+        auto start = Clock::now();
+        sink = sink + body(work);
+        auto end = Clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        best = std::min(best, ns / static_cast<double>(input.size()));
+    }
+    return best;
+}
+
+std::vector<Fruit> sweep_input(std::size_t count) {
+    std::mt19937 rng(42);
+    std::vector<Fruit> fruits;
+    fruits.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        // Mostly healthy, half sweet: the shape of a long worm-free streak.
+        Taste t = rng() % 2 ? Taste::SWEET : Taste::SOUR;
+        Size s = static_cast<Size>(rng() % 3);
+        Quality q = rng() % 8 ? Quality::HEALTHY : Quality::ROTTEN;
+        fruits.emplace_back(t, s, q);
+    }
+    return fruits;
+}
+
+void bench_worm_sweep_kernels() {
+    const std::size_t count = std::size_t(1) << 22;
+    const auto input = sweep_input(count);
+
+    double scalar = best_ns_per_fruit(input, 10, [](std::vector<Fruit>& f) {
+        return total(
+            fruit_kernels::infect_sweet_healthy_scalar(f.data(), f.size()));
+    });
+    report("worm_sweep/scalar", scalar, "ns/fruit");
+
+#ifdef FRUIT_PICKING_X86
+    double sse2 = best_ns_per_fruit(input, 10, [](std::vector<Fruit>& f) {
+        return total(
+            fruit_kernels::infect_sweet_healthy_sse2(f.data(), f.size()));
+    });
+    report("worm_sweep/sse2", sse2, "ns/fruit", scalar);
+
+    if (fruit_kernels::avx2_supported()) {
+        double avx2 = best_ns_per_fruit(input, 10, [](std::vector<Fruit>& f) {
+            return total(
+                fruit_kernels::infect_sweet_healthy_avx2(f.data(), f.size()));
+        });
+        report("worm_sweep/avx2", avx2, "ns/fruit", scalar);
+    }
+#endif
+}
+
+void bench_worm_after_streak() {
+    // One below a power of two so the worm itself does not regrow the log.
+    const std::size_t streak = (std::size_t(1) << 22) - 1;
+    double best = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        Picker p{"Streak"};
+        for (std::size_t i = 0; i < streak; ++i) p += YUMMY_ONE;
+
+        auto start = Clock::now();
+        p += Fruit{Taste::SOUR, Size::SMALL, Quality::WORMY};
+        auto end = Clock::now();
+        sink = sink + p.count_quality(Quality::WORMY);
+        best = std::min(
+            best, std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    report(label("picker/worm_after_%zu_healthy", streak), best, "us");
+}
+
+// Single additions under a random stream and under two streams that keep
+// the worm rule busy: long sweet healthy runs each ended by a worm, and a
+// worm after every healthy fruit.
+void bench_picker_add() {
+    const std::size_t count = std::size_t(1) << 22, run = 4096;
+    const Fruit worm{Taste::SOUR, Size::SMALL, Quality::WORMY};
+    std::mt19937 rng(17);
+    std::vector<Fruit> random, long_runs, alternating;
+    for (std::size_t i = 0; i < count; ++i) {
+        random.emplace_back(static_cast<Taste>(rng() % 2),
+                            static_cast<Size>(rng() % 3),
+                            static_cast<Quality>(rng() % 3));
+        long_runs.push_back(i % run == run - 1 ? worm : YUMMY_ONE);
+        alternating.push_back(i % 2 ? worm : YUMMY_ONE);
+    }
+
+    for (auto [name, input] : {std::pair{"random", &random},
+                               std::pair{"worm_after_runs", &long_runs},
+                               std::pair{"worm_alternating", &alternating}}) {
+        double ns = best_ns_per_fruit(*input, 3, [](std::vector<Fruit>& f) {
+            Picker p{"Adder"};
+            for (const Fruit& fruit : f) p += fruit;
+            return p.count_fruits();
+        });
+        report(label("picker/add_%zu/%s", count, name), ns, "ns/fruit");
+    }
+}
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+std::vector<Ranking> orchard_rankings(std::size_t orchards,
+                                      std::size_t pickers) {
+    std::mt19937 rng(7);
+    std::vector<Ranking> rankings(orchards);
+    for (Ranking& ranking : rankings) {
+        for (std::size_t i = 0; i < pickers; ++i) {
+            Picker p{"Picker"};
+            for (std::size_t f = rng() % 8; f > 0; --f) {
+                p += Fruit{static_cast<Taste>(rng() % 2),
+                           static_cast<Size>(rng() % 3),
+                           static_cast<Quality>(rng() % 3)};
+            }
+            ranking += p;
+        }
+    }
+    return rankings;
+}
+
+void bench_merge_many_rankings() {
+    const std::size_t orchards = 256, pickers = 1000;
+    auto rankings = orchard_rankings(orchards, pickers);
+
+    auto start = Clock::now();
+    Ranking repeated;
+    for (const Ranking& r : rankings) repeated += r;
+    double pairwise = elapsed_ms(start);
+
+    start = Clock::now();
+    Ranking merged = Ranking::merge_all(rankings);
+    double k_way = elapsed_ms(start);
+
+    start = Clock::now();
+    Ranking moved = Ranking::merge_all(std::move(rankings));
+    double k_way_moved = elapsed_ms(start);
+    sink = sink + merged.count_pickers() + moved.count_pickers();
+
+    const std::string name = label("ranking/merge_%zux%zu", orchards, pickers);
+    report(name + "/repeated", pairwise, "ms");
+    report(name + "/merge_all", k_way, "ms", pairwise);
+    report(name + "/moved", k_way_moved, "ms", pairwise);
+}
+
+std::vector<Picker> random_pickers(std::size_t count) {
+    std::mt19937 rng(11);
+    std::vector<Picker> pickers;
+    pickers.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        Picker p{"Picker"};
+        for (std::size_t f = rng() % 8; f > 0; --f) {
+            p += Fruit{static_cast<Taste>(rng() % 2),
+                       static_cast<Size>(rng() % 3),
+                       static_cast<Quality>(rng() % 3)};
+        }
+        pickers.push_back(std::move(p));
+    }
+    return pickers;
+}
+
+void bench_bulk_build() {
+    const std::size_t count = std::size_t(1) << 20;
+    const auto pickers = random_pickers(count);
+
+    auto start = Clock::now();
+    Ranking one_by_one;
+    for (const Picker& p : pickers) one_by_one += p;
+    sink = sink + one_by_one[0].count_fruits();  // settles the insertions
+    double inserting = elapsed_ms(start);
+
+    report(label("ranking/build_%zu/one_by_one", count), inserting, "ms");
+    sink = sink + one_by_one.count_pickers();
+
+    for (auto [mode, name] :
+         {std::pair{Ranking::BuildMode::COMPARISON, "comparison"},
+          std::pair{Ranking::BuildMode::RADIX, "radix"}}) {
+        auto moved_from = pickers;
+        start = Clock::now();
+        Ranking bulk(std::move(moved_from), 0, mode);
+        double building = elapsed_ms(start);
+        sink = sink + bulk.count_pickers();
+        report(label("ranking/build_%zu/%s", count, name), building, "ms",
+               inserting);
+    }
+}
+
+// Heap in use, as malloc counts it, per picker of a ranking built from
+// pickers of 0 to 7 fruits, which includes the pickers it was built from.
+void bench_small_picker_memory() {
+    auto heap_in_use = [] {
+        const auto info = mallinfo2();
+        return info.uordblks + info.hblkhd;  // small chunks and mapped ones
+    };
+    const std::size_t count = std::size_t(1) << 20;
+    const std::size_t before = heap_in_use();
+    auto pickers = random_pickers(count);
+    Ranking ranking(std::move(pickers));
+    sink = sink + ranking[0].count_fruits();
+    const std::size_t after = heap_in_use();
+
+    report(label("ranking/small_pickers_%zu/heap", count),
+           static_cast<double>(after - before) / count, "bytes/picker");
+    report("picker/sizeof", sizeof(Picker), "bytes");
+}
+
+// Reading after every insertion settles each one into the tree on its own,
+// as eager insertion did; reading once at the end sorts them as a batch.
+void bench_lazy_inserts() {
+    const std::size_t count = std::size_t(1) << 20;
+    const auto pickers = random_pickers(count);
+
+    auto start = Clock::now();
+    Ranking eager;
+    for (const Picker& p : pickers) {
+        eager += p;
+        sink = sink + eager[0].count_fruits();
+    }
+    double settling_each = elapsed_ms(start);
+
+    start = Clock::now();
+    Ranking lazy;
+    for (const Picker& p : pickers) lazy += p;
+    sink = sink + lazy[0].count_fruits();
+    double settling_once = elapsed_ms(start);
+
+    report(label("ranking/insert_%zu/read_each", count), settling_each, "ms");
+    report(label("ranking/insert_%zu/read_once", count), settling_once, "ms",
+           settling_each);
+}
+
+// A live leaderboard: one ranked picker gains a fruit, then the leader is
+// read. Without handles the old entry is found by value and re-added.
+void bench_leaderboard_updates() {
+    const std::size_t count = 100000, updates = 20000;
+    auto current = random_pickers(count);
+    std::mt19937 rng(5);
+    std::vector<std::size_t> who(updates);
+    std::vector<Fruit> gained;
+    for (std::size_t u = 0; u < updates; ++u) {
+        who[u] = rng() % count;
+        gained.emplace_back(static_cast<Taste>(rng() % 2),
+                            static_cast<Size>(rng() % 3),
+                            static_cast<Quality>(rng() % 3));
+    }
+
+    auto pickers = current;
+    Ranking by_value;
+    for (const Picker& p : pickers) by_value += p;
+    sink = sink + by_value[0].count_fruits();
+    auto start = Clock::now();
+    for (std::size_t u = 0; u < updates; ++u) {
+        by_value -= pickers[who[u]];
+        pickers[who[u]] += gained[u];
+        by_value += pickers[who[u]];
+        sink = sink + by_value[0].count_fruits();
+    }
+    double removing = elapsed_ms(start);
+
+    pickers = current;
+    Ranking by_handle;
+    std::vector<Ranking::Handle> handles;
+    for (const Picker& p : pickers) handles.push_back(by_handle.add(p));
+    sink = sink + by_handle[0].count_fruits();
+    start = Clock::now();
+    for (std::size_t u = 0; u < updates; ++u) {
+        pickers[who[u]] += gained[u];
+        by_handle.update(handles[who[u]], pickers[who[u]]);
+        sink = sink + by_handle[0].count_fruits();
+    }
+    double updating = elapsed_ms(start);
+
+    const std::string name = label("ranking/update_%zu_of_%zu", updates, count);
+    report(name + "/remove_add", removing, "ms");
+    report(name + "/handle", updating, "ms", removing);
+}
+
+void bench_bulk_steal() {
+    const std::size_t count = std::size_t(1) << 20;
+    const auto fruits = sweep_input(count);
+    Picker basket{"Giver"};
+    basket.add_range(fruits);
+
+    Picker giver = basket, receiver{"Receiver"};
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < count; ++i) receiver += giver;
+    double single = elapsed_ms(start);
+    sink = sink + receiver.count_fruits();
+
+    giver = basket;
+    Picker bulk_receiver{"Receiver"};
+    start = Clock::now();
+    bulk_receiver.steal_all(giver);
+    double bulk = elapsed_ms(start);
+    sink = sink + bulk_receiver.count_fruits();
+
+    report(label("picker/steal_%zu/one_by_one", count), single, "ms");
+    report(label("picker/steal_%zu/steal_all", count), bulk, "ms", single);
+}
+
+// One fruit at a time between random pairs of a crowd, as single steals
+// happen in an orchard, rather than one giver drained in a loop.
+void bench_single_steals() {
+    const std::size_t crowd = 1000, steals = std::size_t(1) << 21;
+    auto pickers = random_pickers(crowd);
+    const auto fruits = sweep_input(crowd * 64);
+    for (std::size_t i = 0; i < crowd; ++i) {
+        pickers[i].add_range(std::span(fruits).subspan(i * 64, 64));
+    }
+    std::mt19937 rng(23);
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs(steals);
+    for (auto& [thief, victim] : pairs) {
+        thief = rng() % crowd;
+        victim = rng() % crowd;
+    }
+
+    auto start = Clock::now();
+    for (auto [thief, victim] : pairs) pickers[thief] += pickers[victim];
+    double stealing = elapsed_ms(start);
+    sink = sink + pickers[0].count_fruits();
+
+    report(label("picker/steal_random_pairs_%zu", steals),
+           stealing * 1e6 / steals, "ns/steal");
+}
+
+// operator<=> on random pairs, and on equal pickers, whose keys tie on
+// every field.
+void bench_compare() {
+    const std::size_t count = std::size_t(1) << 16;
+    const std::size_t compares = std::size_t(1) << 24;
+    const auto pickers = random_pickers(count);
+    std::mt19937 rng(29);
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> pairs(compares);
+    for (auto& [a, b] : pairs) {
+        a = rng() % count;
+        b = rng() % count;
+    }
+
+    for (bool equal : {false, true}) {
+        auto start = Clock::now();
+        std::size_t less = 0;
+        for (auto [a, b] : pairs) {
+            less += (pickers[a] <=> pickers[equal ? a : b]) < 0;
+        }
+        double comparing = elapsed_ms(start);
+        sink = sink + less;
+        report(equal ? "picker/compare/equal" : "picker/compare/random",
+               comparing * 1e6 / compares, "ns/compare");
+    }
+}
+
+// Insertions one by one into rankings of every size from 10 to 1M, each
+// read once at the end; small sizes are repeated to the same total work.
+void bench_ranking_sizes() {
+    const std::size_t largest = 1000000;
+    const auto pickers = random_pickers(largest);
+    for (std::size_t size = 10; size <= largest; size *= 10) {
+        const std::size_t repeats = largest / size;
+        auto start = Clock::now();
+        for (std::size_t r = 0; r < repeats; ++r) {
+            Ranking ranking;
+            for (std::size_t i = 0; i < size; ++i) ranking += pickers[i];
+            sink = sink + ranking[0].count_fruits();
+        }
+        double inserting = elapsed_ms(start);
+        report(label("ranking/insert/%zu", size), inserting * 1e6 / largest,
+               "ns/insert");
+    }
+}
+
+void bench_ranking_remove() {
+    const std::size_t count = std::size_t(1) << 18;
+    auto pickers = random_pickers(count);
+    Ranking ranking(pickers);
+    std::shuffle(pickers.begin(), pickers.end(), std::mt19937(31));
+
+    auto start = Clock::now();
+    for (const Picker& p : pickers) ranking -= p;
+    double removing = elapsed_ms(start);
+    sink = sink + ranking.count_pickers();
+
+    report(label("ranking/remove_%zu", count), removing * 1e6 / count,
+           "ns/remove");
+}
+
+// Cold start: replaying the fruit feed against opening a snapshot and
+// loading the ranking from it.
+void bench_snapshot() {
+    const std::size_t count = std::size_t(1) << 20;
+    const auto pickers = random_pickers(count);
+    const std::string path =
+        (std::filesystem::temp_directory_path() / "fruit_picking_bench.snp")
+            .string();
+
+    auto start = Clock::now();
+    Ranking replayed;
+    for (const Picker& original : pickers) {
+        Picker p{original.get_name()};
+        p.add_range(std::vector<Fruit>(original.count_fruits(), YUMMY_ONE));
+        replayed += p;
+    }
+    sink = sink + replayed[0].count_fruits();
+    double replaying = elapsed_ms(start);
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        start = Clock::now();
+        Snapshot::write(out, replayed);
+        out.flush();
+    }
+    double writing = elapsed_ms(start);
+
+    start = Clock::now();
+    Snapshot snapshot(path);
+    sink = sink + snapshot.count_pickers() + snapshot.fruits(count / 2).size();
+    double opening = elapsed_ms(start);
+
+    start = Clock::now();
+    Ranking loaded = snapshot.ranking();
+    sink = sink + loaded[0].count_fruits();
+    double loading = elapsed_ms(start);
+    std::filesystem::remove(path);
+
+    const std::string name = label("snapshot/ranking_%zu", count);
+    report(name + "/replay", replaying, "ms");
+    report(name + "/write", writing, "ms");
+    report(name + "/open", opening, "ms");
+    report(name + "/load", loading, "ms", replaying);
+}
+
+// Glue code resolving every event by name, against the ingestor. Events come
+// in short runs, as they do when a picker works through a row of trees.
+void bench_event_ingestion() {
+    const std::size_t pickers = 1000, events = std::size_t(1) << 23;
+    std::mt19937 rng(3);
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < pickers; ++i) {
+        names.push_back("Picker-" + std::to_string(i));
+    }
+
+    struct Event {
+        std::uint8_t kind;
+        std::uint32_t first, second;
+        Fruit fruit;
+    };
+    std::vector<Event> feed;
+    feed.reserve(events);
+    std::ostringstream out(std::ios::binary);
+    EventLogWriter writer(out);
+    for (const std::string& name : names) writer.intern(name);
+    while (feed.size() < events) {
+        std::uint8_t kind = rng() % 4 == 0 ? 1 + rng() % 2 : 0;
+        std::uint32_t a = rng() % pickers, b = rng() % pickers;
+        for (std::size_t run = 1 + rng() % 16; run > 0; --run) {
+            Fruit fruit{static_cast<Taste>(rng() % 2),
+                        static_cast<Size>(rng() % 3),
+                        static_cast<Quality>(rng() % 3)};
+            feed.push_back({kind, a, b, fruit});
+            if (kind == 0) writer.add(a, fruit);
+            if (kind == 1) writer.steal(a, b);
+            if (kind == 2) writer.give(a, b);
+        }
+    }
+    const std::string log = out.str();
+
+    auto start = Clock::now();
+    std::map<std::string, Picker> glue;
+    for (const Event& e : feed) {
+        Picker& x = glue.try_emplace(names[e.first], names[e.first])
+                        .first->second;
+        if (e.kind == 0) {
+            x += e.fruit;
+            continue;
+        }
+        Picker& y = glue.try_emplace(names[e.second], names[e.second])
+                        .first->second;
+        if (e.kind == 1) x += y;
+        if (e.kind == 2) x -= y;
+    }
+    double by_name = elapsed_ms(start);
+    sink = sink + glue.size();
+
+    EventIngestor ingestor;
+    IngestStats stats = ingestor.ingest(std::span<const std::byte>(
+        reinterpret_cast<const std::byte*>(log.data()), log.size()));
+    sink = sink + ingestor.count_pickers();
+
+    const std::string name = label("events/%zu", feed.size());
+    report(name + "/by_name", feed.size() / by_name / 1e3, "Mevents/s");
+    report(name + "/ingestor", stats.events_per_second() / 1e6, "Mevents/s");
+}
+
+void bench_text_dump() {
+    const std::size_t count = std::size_t(1) << 18;
+    Ranking ranking(random_pickers(count));
+
+    auto start = Clock::now();
+    std::ostringstream os;
+    os << ranking;
+    double streaming = elapsed_ms(start);
+    sink = sink + os.str().size();
+
+    start = Clock::now();
+    std::string text;
+    append_text(text, ranking);
+    double appending = elapsed_ms(start);
+    sink = sink + text.size();
+
+    const std::string name = label("text/ranking_%zu", count);
+    report(name + "/ostream", text.size() / streaming / 1e3, "MB/s");
+    report(name + "/append_text", text.size() / appending / 1e3, "MB/s");
+}
+
+void bench_text_parse() {
+    const std::size_t count = std::size_t(1) << 18;
+    std::string text;
+    append_text(text, Ranking(random_pickers(count)));
+
+    auto start = Clock::now();
+    auto pickers = parse_pickers(text);
+    double parsing = elapsed_ms(start);
+    sink = sink + pickers.size();
+
+    start = Clock::now();
+    Ranking ranking = parse_ranking(text);
+    double rebuilding = elapsed_ms(start);
+    sink = sink + ranking.count_pickers();
+
+    const std::string name = label("text/parse_%zu", count);
+    report(name + "/pickers", text.size() / parsing / 1e3, "MB/s");
+    report(name + "/ranking", text.size() / rebuilding / 1e3, "MB/s");
+}
+
+void bench_top_k() {
+    const std::size_t count = std::size_t(1) << 20, k = 100;
+    const auto pickers = random_pickers(count);
+
+    auto start = Clock::now();
+    Ranking full;
+    for (const Picker& p : pickers) full += p;
+    auto from_full = full.top(k);
+    double ranking = elapsed_ms(start);
+
+    start = Clock::now();
+    TopKRanking podium(k);
+    for (const Picker& p : pickers) podium += p;
+    auto from_heap = podium.top();
+    double heap = elapsed_ms(start);
+    sink = sink + from_full.size() + from_heap.size();
+
+    report(label("top_%zu_of_%zu/ranking", k, count), ranking, "ms");
+    report(label("top_%zu_of_%zu/top_k", k, count), heap, "ms", ranking);
+}
+
+// Many short-lived rankings, as in one simulation round per ranking: on the
+// default heap against a monotonic arena released after every round.
+void bench_arena_rounds() {
+    const std::size_t size = 1000;
+    const std::size_t rounds = 1000;
+    const auto pickers = random_pickers(size);
+
+    auto start = Clock::now();
+    for (std::size_t r = 0; r < rounds; ++r) {
+        Ranking ranking;
+        for (const Picker& p : pickers) ranking += p;
+        sink = sink + ranking[0].count_fruits();
+    }
+    double heap = elapsed_ms(start);
+
+    std::pmr::monotonic_buffer_resource arena;
+    start = Clock::now();
+    for (std::size_t r = 0; r < rounds; ++r) {
+        {
+            Ranking ranking{&arena};
+            for (const Picker& p : pickers) ranking += p;
+            sink = sink + ranking[0].count_fruits();
+        }
+        arena.release();
+    }
+    double in_arena = elapsed_ms(start);
+
+    report(label("ranking/round_%zu/heap", size), heap * 1e3 / rounds,
+           "us/round");
+    report(label("ranking/round_%zu/arena", size), in_arena * 1e3 / rounds,
+           "us/round", heap * 1e3 / rounds);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+    const std::string path = argc > 1 ? argv[1] : "bench_results.csv";
+    const std::string_view filter = argc > 2 ? argv[2] : "";
+
+    const std::pair<const char*, void (*)()> groups[] = {
+        {"worm_sweep_kernels", bench_worm_sweep_kernels},
+        {"worm_after_streak", bench_worm_after_streak},
+        {"picker_add", bench_picker_add},
+        {"bulk_steal", bench_bulk_steal},
+        {"single_steals", bench_single_steals},
+        {"compare", bench_compare},
+        {"ranking_sizes", bench_ranking_sizes},
+        {"ranking_remove", bench_ranking_remove},
+        {"merge_many_rankings", bench_merge_many_rankings},
+        {"bulk_build", bench_bulk_build},
+        {"small_picker_memory", bench_small_picker_memory},
+        {"lazy_inserts", bench_lazy_inserts},
+        {"leaderboard_updates", bench_leaderboard_updates},
+        {"snapshot", bench_snapshot},
+        {"event_ingestion", bench_event_ingestion},
+        {"text_dump", bench_text_dump},
+        {"text_parse", bench_text_parse},
+        {"top_k", bench_top_k},
+        {"arena_rounds", bench_arena_rounds},
+    };
+    for (auto [name, run] : groups) {
+        if (std::string_view(name).find(filter) != std::string_view::npos) {
+            run();
+        }
+    }
+
+    if (!write_results(path)) {
+        std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return 1;
+    }
+    std::printf("Results written to %s\n", path.c_str());
+}
@@ -0,0 +1,360 @@
+#ifndef FRUIT_PICKING_EVENTS_H
+#define FRUIT_PICKING_EVENTS_H
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "fruit_picking.h"
+#include "fruit_picking_mapped_file.h"
+
+// Binary log of harvest events, in native byte order. After a 16-byte header
+// (magic, version, zero padding) every event is a tag byte and its fields:
+//   NAME   name length (uint16), name bytes
+//   ADD    picker id (uint32), FruitCode byte
+//   STEAL  thief id, victim id (uint32 each): the thief takes one fruit
+//   GIVE   giver id, receiver id (uint32 each): the giver hands one fruit
+// Each NAME event introduces the next picker id of the log, starting at 0,
+// so ids are dense and pickers are named once instead of in every event.
+enum class EventTag : std::uint8_t { NAME = 1, ADD = 2, STEAL = 3, GIVE = 4 };
+
+class EventLogWriter {
+   public:
+    static constexpr std::uint64_t MAGIC = 0x5456455449555246ULL;  // FRUITEVT
+    static constexpr std::uint32_t VERSION = 1;
+
+    // Writes the header.
+    explicit EventLogWriter(std::ostream& os);
+
+    // The id of `name` in this log; the first call for a name logs it.
+    std::uint32_t intern(std::string_view name);
+    void add(std::uint32_t picker, const Fruit& fruit);
+    void steal(std::uint32_t thief, std::uint32_t victim);
+    void give(std::uint32_t giver, std::uint32_t receiver);
+
+   private:
+    std::ostream& os;
+    std::unordered_map<std::string, std::uint32_t> ids;
+
+    template <class... Fields>
+    void put(EventTag tag, Fields... fields);
+};
+
+struct IngestStats {
+    std::uint64_t events = 0;
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+
+    double events_per_second() const {
+        return seconds > 0 ? static_cast<double>(events) / seconds : 0;
+    }
+};
+
+// Applies event logs to pickers that persist across logs; a log's names are
+// resolved to pickers once, when interned, and its events then address them
+// by id. Runs of consecutive events for the same picker or pair go through
+// the bulk operations, add_range and steal_n / give_n, which leave exactly
+// the state the single events would. A malformed log throws
+// std::runtime_error after every event before the bad one has been applied.
+class EventIngestor {
+   public:
+    static constexpr std::size_t CHUNK_SIZE = std::size_t(1) << 20;
+
+    // Each call reads one whole log, `CHUNK_SIZE` bytes at a time for
+    // streams and descriptors, which may be files or pipes.
+    IngestStats ingest(std::istream& in);
+    IngestStats ingest(int fd);
+    // A log already in memory is parsed in place.
+    IngestStats ingest(std::span<const std::byte> log);
+    // Maps the file and parses it in place.
+    IngestStats ingest_file(const std::string& path);
+
+    std::size_t count_pickers() const { return roster.size(); }
+    std::span<const Picker> pickers() const { return roster; }
+    // Throws std::out_of_range for a name no log has mentioned.
+    const Picker& picker(std::string_view name) const;
+
+   private:
+    static constexpr std::size_t HEADER_SIZE = 16;
+
+    enum class Batch : std::uint8_t { NONE, ADD, STEAL, GIVE };
+
+    std::vector<Picker> roster;
+    std::unordered_map<std::string, std::uint32_t> slot_by_name;
+    std::vector<std::uint32_t> slot_of_id;  // for the log being read
+    bool header_seen = false;
+
+    Batch batch = Batch::NONE;
+    std::uint32_t batch_first = 0;
+    std::uint32_t batch_second = 0;
+    std::size_t batch_count = 0;
+    std::vector<Fruit> batch_fruits;
+
+    void begin_log();
+    IngestStats end_log(IngestStats stats, std::size_t leftover,
+                        std::chrono::steady_clock::time_point start);
+    template <class Read>
+    IngestStats ingest_chunks(Read read);
+    std::size_t consume(std::span<const std::byte> bytes, IngestStats& stats);
+    std::uint32_t slot(std::uint32_t id);
+    void extend(Batch kind, std::uint32_t first, std::uint32_t second);
+    void flush();
+    [[noreturn]] void fail(const char* message);
+};
+
+inline EventLogWriter::EventLogWriter(std::ostream& os) : os(os) {
+    const std::uint32_t header[] = {VERSION, 0};
+    os.write(reinterpret_cast<const char*>(&MAGIC), sizeof MAGIC);
+    os.write(reinterpret_cast<const char*>(header), sizeof header);
+}
+
+template <class... Fields>
+void EventLogWriter::put(EventTag tag, Fields... fields) {
+    char bytes[1 + (sizeof(Fields) + ... + 0)];
+    bytes[0] = static_cast<char>(tag);
+    std::size_t size = 1;
+    ((std::memcpy(bytes + size, &fields, sizeof fields),
+      size += sizeof fields),
+     ...);
+    os.write(bytes, static_cast<std::streamsize>(size));
+}
+
+inline std::uint32_t EventLogWriter::intern(std::string_view name) {
+    auto [it, added] = ids.try_emplace(std::string(name),
+                                       static_cast<std::uint32_t>(ids.size()));
+    if (added) {
+        if (name.size() > UINT16_MAX) {
+            throw std::length_error("Picker name too long for an event log");
+        }
+        put(EventTag::NAME, static_cast<std::uint16_t>(name.size()));
+        os.write(name.data(), static_cast<std::streamsize>(name.size()));
+    }
+    return it->second;
+}
+
+inline void EventLogWriter::add(std::uint32_t picker, const Fruit& fruit) {
+    put(EventTag::ADD, picker, fruit.code().value());
+}
+
+inline void EventLogWriter::steal(std::uint32_t thief, std::uint32_t victim) {
+    put(EventTag::STEAL, thief, victim);
+}
+
+inline void EventLogWriter::give(std::uint32_t giver,
+                                 std::uint32_t receiver) {
+    put(EventTag::GIVE, giver, receiver);
+}
+
+inline const Picker& EventIngestor::picker(std::string_view name) const {
+    auto it = slot_by_name.find(std::string(name));
+    if (it == slot_by_name.end()) {
+        throw std::out_of_range("No picker named " + std::string(name));
+    }
+    return roster[it->second];
+}
+
+inline IngestStats EventIngestor::ingest(std::istream& in) {
+    return ingest_chunks([&in](std::byte* into, std::size_t size) {
+        in.read(reinterpret_cast<char*>(into),
+                static_cast<std::streamsize>(size));
+        return static_cast<std::size_t>(in.gcount());
+    });
+}
+
+inline IngestStats EventIngestor::ingest(int fd) {
+    return ingest_chunks([this, fd](std::byte* into, std::size_t size) {
+        while (true) {
+            ssize_t got = ::read(fd, into, size);
+            if (got >= 0) return static_cast<std::size_t>(got);
+            if (errno != EINTR) fail("Event log read failed");
+        }
+    });
+}
+
+inline IngestStats EventIngestor::ingest(std::span<const std::byte> log) {
+    const auto start = std::chrono::steady_clock::now();
+    begin_log();
+    IngestStats stats;
+    stats.bytes = log.size();
+    const std::size_t used = consume(log, stats);
+    return end_log(stats, log.size() - used, start);
+}
+
+inline IngestStats EventIngestor::ingest_file(const std::string& path) {
+    const MappedFile file(path, MappedFile::Access::SEQUENTIAL);
+    return ingest(file.bytes());
+}
+
+// Events never straddle a refill: the unparsed tail moves to the front of
+// the buffer, which always holds the longest possible event.
+template <class Read>
+IngestStats EventIngestor::ingest_chunks(Read read) {
+    const auto start = std::chrono::steady_clock::now();
+    begin_log();
+    IngestStats stats;
+    std::vector<std::byte> buffer(CHUNK_SIZE);
+    std::size_t filled = 0;
+    while (std::size_t got =
+               read(buffer.data() + filled, buffer.size() - filled)) {
+        filled += got;
+        stats.bytes += got;
+        const std::size_t used = consume({buffer.data(), filled}, stats);
+        std::memmove(buffer.data(), buffer.data() + used, filled - used);
+        filled -= used;
+    }
+    return end_log(stats, filled, start);
+}
+
+inline void EventIngestor::begin_log() {
+    slot_of_id.clear();
+    header_seen = false;
+}
+
+inline IngestStats EventIngestor::end_log(
+    IngestStats stats, std::size_t leftover,
+    std::chrono::steady_clock::time_point start) {
+    if (!header_seen) fail("Event log has no header");
+    if (leftover != 0) fail("Event log ends inside an event");
+    flush();
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    return stats;
+}
+
+// Parses every complete event in `bytes` and returns how many bytes they
+// took.
+inline std::size_t EventIngestor::consume(std::span<const std::byte> bytes,
+                                          IngestStats& stats) {
+    const std::byte* p = bytes.data();
+    const std::byte* const end = p + bytes.size();
+    auto read = [&p](auto& field) {
+        std::memcpy(&field, p, sizeof field);
+        p += sizeof field;
+    };
+
+    if (!header_seen) {
+        if (bytes.size() < HEADER_SIZE) return 0;
+        std::uint64_t magic;
+        std::uint32_t version;
+        read(magic);
+        read(version);
+        p += sizeof(std::uint32_t);
+        if (magic != EventLogWriter::MAGIC) {
+            fail("Not an event log, or of another byte order");
+        }
+        if (version != EventLogWriter::VERSION) {
+            fail("Unsupported event log version");
+        }
+        header_seen = true;
+    }
+
+    while (p != end) {
+        const std::byte* const event = p;
+        const auto tag = static_cast<EventTag>(*p++);
+        const auto left = static_cast<std::size_t>(end - p);
+        std::uint32_t first, second;
+        switch (tag) {
+            case EventTag::NAME: {
+                std::uint16_t length;
+                if (left < sizeof length) return event - bytes.data();
+                read(length);
+                if (left < sizeof length + length) {
+                    return event - bytes.data();
+                }
+                std::string name(reinterpret_cast<const char*>(p), length);
+                p += length;
+                auto [it, added] = slot_by_name.try_emplace(
+                    name, static_cast<std::uint32_t>(roster.size()));
+                if (added) roster.emplace_back(name);
+                slot_of_id.push_back(it->second);
+                break;
+            }
+            case EventTag::ADD: {
+                FruitCode::value_type code;
+                if (left < sizeof first + sizeof code) {
+                    return event - bytes.data();
+                }
+                read(first);
+                read(code);
+                const auto fruit = FruitCode::try_from_value(code);
+                if (!fruit) fail("Event log holds an invalid fruit");
+                extend(Batch::ADD, slot(first), 0);
+                batch_fruits.emplace_back(*fruit);
+                break;
+            }
+            case EventTag::STEAL:
+            case EventTag::GIVE:
+                if (left < sizeof first + sizeof second) {
+                    return event - bytes.data();
+                }
+                read(first);
+                read(second);
+                extend(tag == EventTag::STEAL ? Batch::STEAL : Batch::GIVE,
+                       slot(first), slot(second));
+                ++batch_count;
+                break;
+            default:
+                fail("Event log holds an unknown event");
+        }
+        ++stats.events;
+    }
+    return bytes.size();
+}
+
+inline std::uint32_t EventIngestor::slot(std::uint32_t id) {
+    if (id >= slot_of_id.size()) {
+        fail("Event log uses a picker id before naming it");
+    }
+    return slot_of_id[id];
+}
+
+// Starts a new batch unless the event continues the current one.
+inline void EventIngestor::extend(Batch kind, std::uint32_t first,
+                                  std::uint32_t second) {
+    if (batch == kind && batch_first == first && batch_second == second) {
+        return;
+    }
+    flush();
+    batch = kind;
+    batch_first = first;
+    batch_second = second;
+}
+
+inline void EventIngestor::flush() {
+    switch (batch) {
+        case Batch::NONE:
+            break;
+        case Batch::ADD:
+            roster[batch_first].add_range(batch_fruits);
+            break;
+        case Batch::STEAL:
+            roster[batch_first].steal_n(roster[batch_second], batch_count);
+            break;
+        case Batch::GIVE:
+            roster[batch_first].give_n(roster[batch_second], batch_count);
+            break;
+    }
+    batch = Batch::NONE;
+    batch_count = 0;
+    batch_fruits.clear();
+}
+
+inline void EventIngestor::fail(const char* message) {
+    flush();
+    throw std::runtime_error(message);
+}
+
+#endif  // FRUIT_PICKING_EVENTS_H
@@ -0,0 +1,219 @@
+#ifndef FRUIT_PICKING_FORMAT_H
+#define FRUIT_PICKING_FORMAT_H
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "fruit_picking.h"
+
+// Text output without iostreams: pickers and rankings are rendered byte for
+// byte as operator<< prints them, but from pre-rendered fruit lines straight
+// into a string or a descriptor's buffer.
+
+// Exact length of the text, in O(1) for a picker: its counts give the
+// number of fruits behind every pre-rendered line.
+inline std::size_t text_size(const Picker& picker);
+inline std::size_t text_size(const Ranking& ranking);
+
+// Appends the text to `out`, reserving the space once.
+inline void append_text(std::string& out, const Picker& picker);
+inline void append_text(std::string& out, const Ranking& ranking);
+
+// Buffered text output to a file descriptor. The buffer is part of the
+// writer, so writing never allocates. The destructor flushes and drops any
+// error; call flush() to have it thrown as std::runtime_error.
+class TextWriter {
+   public:
+    static constexpr std::size_t BUFFER_SIZE = std::size_t(1) << 16;
+
+    explicit TextWriter(int fd) : fd(fd) {}
+    TextWriter(const TextWriter&) = delete;
+    TextWriter& operator=(const TextWriter&) = delete;
+    ~TextWriter();
+
+    TextWriter& operator<<(std::string_view text);
+    TextWriter& operator<<(const Picker& picker);
+    TextWriter& operator<<(const Ranking& ranking);
+    void flush();
+
+   private:
+    int fd;
+    std::size_t used = 0;
+    std::array<char, BUFFER_SIZE> buffer;
+};
+
+namespace fruit_text {
+
+// "\n\t" and the fruit, the way a picker prints every fruit.
+inline constexpr auto LINES = [] {
+    std::array<Rendered, FruitCode::VALUE_COUNT> table{};
+    for (std::size_t value = 0; value < table.size(); ++value) {
+        if (FRUITS[value].size == 0) continue;
+        Rendered& line = table[value];
+        line.bytes[line.size++] = '\n';
+        line.bytes[line.size++] = '\t';
+        for (char c : FRUITS[value].view()) line.bytes[line.size++] = c;
+    }
+    return table;
+}();
+
+// Lines are copied whole, so writing one needs this much room.
+inline constexpr std::size_t SLACK = sizeof(Rendered::bytes);
+
+// A line's length is a base plus one extra per attribute, so a picker's
+// text length follows from its marginal counts.
+struct LineLengths {
+    std::size_t base;
+    std::array<std::size_t, 2> taste;
+    std::array<std::size_t, 3> size;
+    std::array<std::size_t, 3> quality;
+};
+
+inline constexpr LineLengths LINE_LENGTHS = [] {
+    auto length = [](std::size_t t, std::size_t s, std::size_t q) {
+        return LINES[FruitCode::encode(static_cast<Taste>(t),
+                                       static_cast<Size>(s),
+                                       static_cast<Quality>(q))
+                         .value()]
+            .size;
+    };
+    LineLengths lengths{length(0, 0, 0), {}, {}, {}};
+    for (std::size_t i = 0; i < 3; ++i) {
+        if (i < 2) lengths.taste[i] = length(i, 0, 0) - lengths.base;
+        lengths.size[i] = length(0, i, 0) - lengths.base;
+        lengths.quality[i] = length(0, 0, i) - lengths.base;
+    }
+    return lengths;
+}();
+
+// Writes the lines of `fruits` at `out`, which must have room for them
+// plus SLACK bytes, and returns the new end.
+inline char* write_lines(char* out, std::span<const Fruit> fruits) {
+    for (const Fruit& fruit : fruits) {
+        const Rendered& line = LINES[fruit.code().value()];
+        std::memcpy(out, line.bytes.data(), SLACK);
+        out += line.size;
+    }
+    return out;
+}
+
+inline char* write_picker(char* out, const Picker& picker) {
+    const std::string_view name = picker.get_name();
+    out = std::copy(name.begin(), name.end(), out);
+    *out++ = ':';
+    return write_lines(out, picker.fruits());
+}
+
+}  // namespace fruit_text
+
+inline std::size_t text_size(const Picker& picker) {
+    using fruit_text::LINE_LENGTHS;
+    std::size_t size = picker.get_name().size() + 1 +
+                       picker.count_fruits() * LINE_LENGTHS.base;
+    for (Taste t : {Taste::SWEET, Taste::SOUR}) {
+        size += picker.count_taste(t) *
+                LINE_LENGTHS.taste[static_cast<std::size_t>(t)];
+    }
+    for (Size s : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+        size += picker.count_size(s) *
+                LINE_LENGTHS.size[static_cast<std::size_t>(s)];
+    }
+    for (Quality q : {Quality::HEALTHY, Quality::ROTTEN, Quality::WORMY}) {
+        size += picker.count_quality(q) *
+                LINE_LENGTHS.quality[static_cast<std::size_t>(q)];
+    }
+    return size;
+}
+
+inline std::size_t text_size(const Ranking& ranking) {
+    std::size_t size = 0;
+    ranking.for_each(
+        [&size](const Picker& picker) { size += text_size(picker) + 1; });
+    return size;
+}
+
+inline void append_text(std::string& out, const Picker& picker) {
+    const std::size_t old = out.size();
+    out.resize_and_overwrite(
+        old + text_size(picker) + fruit_text::SLACK,
+        [&](char* data, std::size_t) {
+            return fruit_text::write_picker(data + old, picker) - data;
+        });
+}
+
+inline void append_text(std::string& out, const Ranking& ranking) {
+    const std::size_t old = out.size();
+    out.resize_and_overwrite(
+        old + text_size(ranking) + fruit_text::SLACK,
+        [&](char* data, std::size_t) {
+            char* end = data + old;
+            ranking.for_each([&end](const Picker& picker) {
+                end = fruit_text::write_picker(end, picker);
+                *end++ = '\n';
+            });
+            return end - data;
+        });
+}
+
+inline TextWriter::~TextWriter() {
+    try {
+        flush();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+inline TextWriter& TextWriter::operator<<(std::string_view text) {
+    while (!text.empty()) {
+        if (used == buffer.size()) flush();
+        const std::size_t n = std::min(text.size(), buffer.size() - used);
+        std::copy_n(text.data(), n, buffer.data() + used);
+        used += n;
+        text.remove_prefix(n);
+    }
+    return *this;
+}
+
+// Lines go in one at a time, so a picker may be larger than the buffer.
+inline TextWriter& TextWriter::operator<<(const Picker& picker) {
+    *this << picker.get_name() << std::string_view(":");
+    for (const Fruit& fruit : picker.fruits()) {
+        if (buffer.size() - used < fruit_text::SLACK) flush();
+        used = static_cast<std::size_t>(
+            fruit_text::write_lines(buffer.data() + used, {&fruit, 1}) -
+            buffer.data());
+    }
+    return *this;
+}
+
+inline TextWriter& TextWriter::operator<<(const Ranking& ranking) {
+    ranking.for_each([this](const Picker& picker) {
+        *this << picker << std::string_view("\n");
+    });
+    return *this;
+}
+
+inline void TextWriter::flush() {
+    std::size_t written = 0;
+    while (written < used) {
+        ssize_t n = ::write(fd, buffer.data() + written, used - written);
+        if (n < 0 && errno == EINTR) continue;
+        // A descriptor that takes nothing would be retried forever.
+        if (n <= 0) {
+            used = 0;
+            throw std::runtime_error("TextWriter: write failed");
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    used = 0;
+}
+
+#endif  // FRUIT_PICKING_FORMAT_H
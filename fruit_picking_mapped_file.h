@@ -0,0 +1,79 @@
+#ifndef FRUIT_PICKING_MAPPED_FILE_H
+#define FRUIT_PICKING_MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// A whole file mapped read-only, for the loaders that parse files in place.
+// An empty file maps to an empty span.
+class MappedFile {
+   public:
+    enum class Access : std::uint8_t { RANDOM, SEQUENTIAL };
+
+    // Throws std::runtime_error if the file cannot be opened or mapped.
+    explicit MappedFile(const std::string& path,
+                        Access access = Access::RANDOM);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept
+        : data(std::exchange(other.data, nullptr)),
+          size(std::exchange(other.size, 0)) {}
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile() { unmap(); }
+
+    std::span<const std::byte> bytes() const { return {data, size}; }
+
+   private:
+    const std::byte* data = nullptr;
+    std::size_t size = 0;
+
+    void unmap();
+};
+
+inline MappedFile::MappedFile(const std::string& path, Access access) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open " + path);
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path);
+    }
+    size = static_cast<std::size_t>(status.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return;
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+    if (access == Access::SEQUENTIAL) {
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+    }
+    data = static_cast<const std::byte*>(mapping);
+}
+
+inline MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        unmap();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+    }
+    return *this;
+}
+
+inline void MappedFile::unmap() {
+    if (data) ::munmap(const_cast<std::byte*>(data), size);
+    data = nullptr;
+    size = 0;
+}
+
+#endif  // FRUIT_PICKING_MAPPED_FILE_H
@@ -0,0 +1,174 @@
+#ifndef FRUIT_PICKING_PARSE_H
+#define FRUIT_PICKING_PARSE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fruit_picking.h"
+#include "fruit_picking_format.h"
+#include "fruit_picking_mapped_file.h"
+
+// Reads the text operator<< prints back into pickers: a "name:" line, then
+// one "\t[taste size quality]" line per fruit. A ranking prints its pickers
+// one after another, each followed by a newline. Names must not contain
+// newlines; a name ends at the last ':' of its line.
+//
+// Parsing throws std::runtime_error naming the line of the first problem.
+
+inline std::vector<Picker> parse_pickers(std::string_view text);
+// Exactly one picker, printed on its own or as a one-picker ranking.
+inline Picker parse_picker(std::string_view text);
+// Rebuilds the ranking; equal pickers keep their printed order.
+inline Ranking parse_ranking(std::string_view text, std::size_t threads = 0);
+// Maps the file at `path` and parses it in place.
+inline Ranking load_ranking_text(const std::string& path,
+                                 std::size_t threads = 0);
+
+namespace fruit_text {
+
+// Fruit lines are matched by a perfect hash: the first letters of the
+// taste and of the size pick the line's candidate code among the 6 (taste,
+// size) pairs, and the first letter of the quality, at an offset the size
+// fixes, picks among 3. The candidate is then compared with the rendered
+// line, so every other byte is checked too.
+class FruitLineMatcher {
+   public:
+    // The length of the fruit line at the start of `text`, "\n\t" included,
+    // with its fruit in `fruit`; 0 if `text` does not start with one.
+    std::size_t match(std::string_view text, Fruit& fruit) const;
+
+   private:
+    static constexpr std::size_t TASTE_AT = 3;  // after "\n\t["
+    static constexpr std::size_t SIZE_AT = TASTE_AT + 7 + 1;
+
+    struct Table {
+        std::array<std::int8_t, 256> taste;
+        std::array<std::int8_t, 256> size;
+        std::array<std::int8_t, 256> quality;
+        std::array<std::size_t, 3> quality_at;
+    };
+
+    static constexpr Table TABLE = [] {
+        Table table{};
+        table.taste.fill(-1);
+        table.size.fill(-1);
+        table.quality.fill(-1);
+        for (std::size_t value = 0; value < FruitCode::VALUE_COUNT; ++value) {
+            const auto code = FruitCode::try_from_value(value);
+            if (!code) continue;
+            const auto t = static_cast<std::size_t>(code->taste());
+            const auto s = static_cast<std::size_t>(code->size());
+            const auto q = static_cast<std::size_t>(code->quality());
+            const Rendered& line = LINES[value];
+            table.taste[static_cast<unsigned char>(line.bytes[TASTE_AT])] =
+                static_cast<std::int8_t>(t);
+            table.size[static_cast<unsigned char>(line.bytes[SIZE_AT])] =
+                static_cast<std::int8_t>(s);
+            // The quality follows the last space of the line.
+            std::size_t at = line.size;
+            while (line.bytes[at - 1] != ' ') --at;
+            table.quality_at[s] = at;
+            table.quality[static_cast<unsigned char>(line.bytes[at])] =
+                static_cast<std::int8_t>(q);
+        }
+        return table;
+    }();
+};
+
+}  // namespace fruit_text
+
+inline std::size_t fruit_text::FruitLineMatcher::match(std::string_view text,
+                                                       Fruit& fruit) const {
+    if (text.size() <= SIZE_AT) return 0;
+    auto byte = [&text](std::size_t at) {
+        return static_cast<unsigned char>(text[at]);
+    };
+    const int t = TABLE.taste[byte(TASTE_AT)];
+    const int s = TABLE.size[byte(SIZE_AT)];
+    if (t < 0 || s < 0) return 0;
+    const std::size_t quality_at = TABLE.quality_at[s];
+    if (text.size() <= quality_at) return 0;
+    const int q = TABLE.quality[byte(quality_at)];
+    if (q < 0) return 0;
+
+    const auto code = FruitCode::encode(static_cast<Taste>(t),
+                                        static_cast<Size>(s),
+                                        static_cast<Quality>(q));
+    const std::string_view line = LINES[code.value()].view();
+    if (!text.starts_with(line)) return 0;
+    fruit = Fruit{code};
+    return line.size();
+}
+
+// Walks the text once; the fruits of each picker collect in one reused
+// buffer and become its history without replaying any rules.
+inline std::vector<Picker> parse_pickers(std::string_view text) {
+    const fruit_text::FruitLineMatcher matcher;
+    std::vector<Picker> pickers;
+    std::vector<Fruit> fruits;
+    std::size_t line = 1;
+    auto fail = [&line](const char* problem) {
+        throw std::runtime_error("Line " + std::to_string(line) + ": " +
+                                 problem);
+    };
+
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t end = text.find('\n', pos);
+        if (end == std::string_view::npos) end = text.size();
+        std::string_view name = text.substr(pos, end - pos);
+        if (name.size() < 2 || name.back() != ':') {
+            fail("expected a picker name followed by ':'");
+        }
+        name.remove_suffix(1);
+        pos = end;
+
+        fruits.clear();
+        Fruit fruit{YUMMY_ONE};
+        while (text.substr(pos, 2) == "\n\t") {
+            ++line;
+            const std::size_t length = matcher.match(text.substr(pos), fruit);
+            if (length == 0) fail("expected a fruit");
+            fruits.push_back(fruit);
+            pos += length;
+        }
+        pickers.push_back(Picker::from_history(name, fruits));
+
+        // A newline ends every picker of a ranking.
+        if (pos < text.size()) {
+            if (text[pos] != '\n') fail("expected a fruit or a newline");
+            ++pos;
+            ++line;
+        }
+    }
+    return pickers;
+}
+
+inline Picker parse_picker(std::string_view text) {
+    std::vector<Picker> pickers = parse_pickers(text);
+    if (pickers.size() != 1) {
+        throw std::runtime_error("Expected one picker, found " +
+                                 std::to_string(pickers.size()));
+    }
+    return std::move(pickers.front());
+}
+
+inline Ranking parse_ranking(std::string_view text, std::size_t threads) {
+    return Ranking(parse_pickers(text), threads);
+}
+
+inline Ranking load_ranking_text(const std::string& path,
+                                 std::size_t threads) {
+    const MappedFile file(path, MappedFile::Access::SEQUENTIAL);
+    const auto bytes = file.bytes();
+    return parse_ranking(
+        {reinterpret_cast<const char*>(bytes.data()), bytes.size()}, threads);
+}
+
+#endif  // FRUIT_PICKING_PARSE_H
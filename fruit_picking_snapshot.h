@@ -0,0 +1,331 @@
+#ifndef FRUIT_PICKING_SNAPSHOT_H
+#define FRUIT_PICKING_SNAPSHOT_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fruit_picking.h"
+#include "fruit_picking_mapped_file.h"
+
+// Versioned binary snapshot of a Picker or a Ranking. Opening one maps the
+// file into memory, so it costs the same for any size, and names and fruits
+// can be read in place. Every picker record carries its counters, worm
+// bookkeeping and fingerprint next to its packed fruits, so loading a
+// picker copies its history in one go instead of replaying it.
+//
+// Layout, in native byte order with every part 8-byte aligned:
+//   Header     magic, version, kind, picker count, directory offset
+//   records    one per picker, best first: a RecordHeader, the name bytes,
+//              one FruitCode byte per fruit, zero padding
+//   directory  the offset of every record, as uint64
+class Snapshot {
+   public:
+    enum class Kind : std::uint32_t { PICKER = 1, RANKING = 2 };
+
+    static constexpr std::uint32_t VERSION = 1;
+
+    // Throw std::runtime_error if the stream fails.
+    static void write(std::ostream& os, const Picker& picker);
+    static void write(std::ostream& os, const Ranking& ranking);
+
+    // Maps the snapshot at `path`. Throws std::runtime_error if the file
+    // cannot be mapped or its header is malformed; records are checked as
+    // they are read.
+    explicit Snapshot(const std::string& path);
+
+    Kind kind() const { return header().kind; }
+    std::size_t count_pickers() const { return header().count; }
+
+    // Views into the mapping, valid while the snapshot is open.
+    std::string_view name(std::size_t index) const;
+    std::span<const Fruit> fruits(std::size_t index) const;
+
+    Picker picker(std::size_t index = 0) const;
+    // Loads the pickers on `threads` workers, 0 meaning one per hardware
+    // thread.
+    Ranking ranking(std::size_t threads = 0) const;
+
+   private:
+    static constexpr std::uint64_t MAGIC = 0x504e535449555246ULL;  // FRUITSNP
+    static constexpr std::size_t CODE_COUNT = 18;
+
+    struct Header {
+        std::uint64_t magic;
+        std::uint32_t version;
+        Kind kind;
+        std::uint64_t count;
+        std::uint64_t directory;
+    };
+
+    struct RecordHeader {
+        std::uint64_t fruit_count;
+        std::uint64_t last_wormy_index;
+        std::uint64_t fingerprint;
+        std::uint64_t name_size;
+        std::array<std::uint64_t, CODE_COUNT> counts;  // by VALID_CODES
+    };
+
+    struct Record {
+        RecordHeader header;
+        const std::byte* name;
+        const std::byte* fruits;
+    };
+
+    // The values of the 18 valid fruit codes, in enumeration order, which
+    // is the order of their values.
+    static constexpr auto VALID_CODES = [] {
+        std::array<FruitCode::value_type, CODE_COUNT> codes{};
+        std::size_t next = 0;
+        for (std::size_t value = 0; value < FruitCode::VALUE_COUNT; ++value) {
+            if (auto code = FruitCode::try_from_value(value)) {
+                codes[next++] = code->value();
+            }
+        }
+        return codes;
+    }();
+    // The index into VALID_CODES of every byte, CODE_COUNT for bytes that
+    // are no fruit code.
+    static constexpr auto CODE_INDEX = [] {
+        std::array<std::uint8_t, 256> index;
+        index.fill(CODE_COUNT);
+        for (std::size_t i = 0; i < CODE_COUNT; ++i) {
+            index[VALID_CODES[i]] = static_cast<std::uint8_t>(i);
+        }
+        return index;
+    }();
+
+    MappedFile file;
+    const std::byte* data;
+    std::size_t size;
+
+    static constexpr std::size_t padded(std::size_t bytes) {
+        return (bytes + 7) & ~std::size_t(7);
+    }
+    static std::size_t record_size(const Picker& picker);
+    static void write_pickers(std::ostream& os, Kind kind,
+                              std::span<const Picker* const> pickers);
+    static void write_record(std::ostream& os, const Picker& picker);
+
+    const Header& header() const {
+        return *reinterpret_cast<const Header*>(data);
+    }
+    void check_header() const;
+    Record record(std::size_t index) const;
+    static std::span<const Fruit> checked_fruits(const Record& record);
+};
+
+inline void Snapshot::write(std::ostream& os, const Picker& picker) {
+    const Picker* only = &picker;
+    write_pickers(os, Kind::PICKER, std::span(&only, 1));
+}
+
+inline void Snapshot::write(std::ostream& os, const Ranking& ranking) {
+    ranking.settle();
+    std::vector<const Picker*> pickers;
+    pickers.reserve(ranking.count_pickers());
+    for (Ranking::NodeIndex node : ranking.in_order()) {
+        pickers.push_back(&ranking.nodes[node].picker);
+    }
+    write_pickers(os, Kind::RANKING, pickers);
+}
+
+inline std::size_t Snapshot::record_size(const Picker& picker) {
+    return sizeof(RecordHeader) +
+           padded(picker.picker_name.size() + picker.count_fruits());
+}
+
+// Record sizes are known up front, so the directory can follow the records
+// and the stream is written front to back; pipes work as well as files.
+inline void Snapshot::write_pickers(std::ostream& os, Kind kind,
+                                    std::span<const Picker* const> pickers) {
+    std::vector<std::uint64_t> offsets;
+    offsets.reserve(pickers.size());
+    std::uint64_t offset = sizeof(Header);
+    for (const Picker* picker : pickers) {
+        offsets.push_back(offset);
+        offset += record_size(*picker);
+    }
+
+    const Header header{MAGIC, VERSION, kind, pickers.size(), offset};
+    os.write(reinterpret_cast<const char*>(&header), sizeof header);
+    for (const Picker* picker : pickers) write_record(os, *picker);
+    os.write(reinterpret_cast<const char*>(offsets.data()),
+             static_cast<std::streamsize>(offsets.size() *
+                                          sizeof(std::uint64_t)));
+    if (!os) throw std::runtime_error("Snapshot write failed");
+}
+
+inline void Snapshot::write_record(std::ostream& os, const Picker& picker) {
+    RecordHeader record{};
+    record.fruit_count = picker.count_fruits();
+    record.last_wormy_index = picker.last_wormy_index;
+    record.fingerprint = picker.content_fingerprint.value();
+    record.name_size = picker.picker_name.size();
+    for (std::size_t i = 0; i < CODE_COUNT; ++i) {
+        auto [taste, size, quality] =
+            FruitCode::from_value(VALID_CODES[i]).decode();
+        record.counts[i] = picker.count(taste, size, quality);
+    }
+
+    os.write(reinterpret_cast<const char*>(&record), sizeof record);
+    os.write(picker.picker_name.data(),
+             static_cast<std::streamsize>(picker.picker_name.size()));
+    auto fruits = picker.collected_fruits.fruits();
+    os.write(reinterpret_cast<const char*>(fruits.data()),
+             static_cast<std::streamsize>(fruits.size()));
+    const std::size_t bytes = picker.picker_name.size() + fruits.size();
+    static constexpr char zeros[8] = {};
+    os.write(zeros, static_cast<std::streamsize>(padded(bytes) - bytes));
+}
+
+inline Snapshot::Snapshot(const std::string& path)
+    : file(path),
+      data(file.bytes().data()),
+      size(file.bytes().size()) {
+    if (size < sizeof(Header)) {
+        throw std::runtime_error("Snapshot " + path + " is truncated");
+    }
+    check_header();
+}
+
+inline void Snapshot::check_header() const {
+    const Header& h = header();
+    if (h.magic != MAGIC) {
+        throw std::runtime_error("Not a snapshot, or of another byte order");
+    }
+    if (h.version != VERSION) {
+        throw std::runtime_error("Unsupported snapshot version " +
+                                 std::to_string(h.version));
+    }
+    if (h.kind != Kind::PICKER && h.kind != Kind::RANKING) {
+        throw std::runtime_error("Unknown snapshot kind");
+    }
+    if (h.kind == Kind::PICKER && h.count != 1) {
+        throw std::runtime_error("Picker snapshot without exactly one picker");
+    }
+    if (h.directory % 8 != 0 || h.directory < sizeof(Header) ||
+        h.directory > size ||
+        h.count > (size - h.directory) / sizeof(std::uint64_t)) {
+        throw std::runtime_error("Snapshot directory out of bounds");
+    }
+}
+
+inline Snapshot::Record Snapshot::record(std::size_t index) const {
+    if (index >= count_pickers()) {
+        throw std::out_of_range("Snapshot has no picker " +
+                                std::to_string(index));
+    }
+    std::uint64_t offset;
+    std::memcpy(&offset,
+                data + header().directory + index * sizeof(std::uint64_t),
+                sizeof offset);
+
+    const std::size_t end = header().directory;
+    if (offset < sizeof(Header) || offset % 8 != 0 || offset > end ||
+        end - offset < sizeof(RecordHeader)) {
+        throw std::runtime_error("Snapshot record out of bounds");
+    }
+    Record result;
+    std::memcpy(&result.header, data + offset, sizeof(RecordHeader));
+    const RecordHeader& h = result.header;
+    const std::size_t body = end - offset - sizeof(RecordHeader);
+    if (h.name_size > body || h.fruit_count > body - h.name_size) {
+        throw std::runtime_error("Snapshot record out of bounds");
+    }
+    result.name = data + offset + sizeof(RecordHeader);
+    result.fruits = result.name + h.name_size;
+    return result;
+}
+
+inline std::string_view Snapshot::name(std::size_t index) const {
+    Record r = record(index);
+    return {reinterpret_cast<const char*>(r.name), r.header.name_size};
+}
+
+// Fruit is a single trivially copyable byte holding its FruitCode. Every
+// byte is recounted by code and fingerprinted again, so a record whose
+// bytes are no fruit codes or disagree with its counters or fingerprint
+// never reaches anything indexed or compared by them.
+inline std::span<const Fruit> Snapshot::checked_fruits(const Record& r) {
+    const RecordHeader& h = r.header;
+    std::array<std::uint64_t, CODE_COUNT + 1> counts{};
+    FruitFingerprint fingerprint;
+    for (std::uint64_t i = 0; i < h.fruit_count; ++i) {
+        const auto value = std::to_integer<std::uint8_t>(r.fruits[i]);
+        ++counts[CODE_INDEX[value]];
+        fingerprint.push_back(FruitCode::from_value(value));
+    }
+    if (counts[CODE_COUNT] != 0) {
+        throw std::runtime_error("Snapshot record holds an invalid fruit");
+    }
+    if (!std::equal(h.counts.begin(), h.counts.end(), counts.begin()) ||
+        fingerprint.value() != h.fingerprint) {
+        throw std::runtime_error("Snapshot record is inconsistent");
+    }
+    return {reinterpret_cast<const Fruit*>(r.fruits), h.fruit_count};
+}
+
+inline std::span<const Fruit> Snapshot::fruits(std::size_t index) const {
+    return checked_fruits(record(index));
+}
+
+// Trusts the stored worm index as far as it lies among the fruits; the
+// counters and fingerprint are checked against the fruits themselves.
+inline Picker Snapshot::picker(std::size_t index) const {
+    Record r = record(index);
+    const RecordHeader& h = r.header;
+    const std::span<const Fruit> fruits = checked_fruits(r);
+    if (h.last_wormy_index != FruitLog::npos &&
+        h.last_wormy_index >= h.fruit_count) {
+        throw std::runtime_error("Snapshot record is inconsistent");
+    }
+
+    Picker result{std::string_view(reinterpret_cast<const char*>(r.name),
+                                   h.name_size)};
+    result.collected_fruits.append(fruits);
+    for (std::size_t i = 0; i < CODE_COUNT; ++i) {
+        if (h.counts[i] == 0) continue;
+        result.count_in(FruitCode::from_value(VALID_CODES[i]), h.counts[i]);
+    }
+    result.content_fingerprint =
+        FruitFingerprint::from_value(h.fingerprint, h.fruit_count);
+    result.last_wormy_index = h.last_wormy_index;
+    return result;
+}
+
+// Records are stored best first, so the treap is built directly; the order
+// is checked on the way, as a misordered tree would break every lookup.
+// Loading a picker allocates from the default resource, so the workers
+// share it only if it is thread-safe.
+inline Ranking Snapshot::ranking(std::size_t threads) const {
+    const std::size_t n = count_pickers();
+    Ranking::NodeVector nodes(n);
+    const std::size_t workers = Ranking::allocating_workers(
+        Ranking::worker_count(n, threads), nodes.get_allocator());
+    Ranking::run_workers(workers, [&](std::size_t t) {
+        for (std::size_t i = n * t / workers; i < n * (t + 1) / workers; ++i) {
+            nodes[i].picker = picker(i);
+            nodes[i].fingerprint = nodes[i].picker.fingerprint();
+        }
+    });
+    for (std::size_t i = 1; i < n; ++i) {
+        if (nodes[i].picker < nodes[i - 1].picker) {
+            throw std::runtime_error("Snapshot ranking is out of order");
+        }
+    }
+    Ranking result;
+    result.assign_sorted(std::move(nodes));
+    return result;
+}
+
+#endif  // FRUIT_PICKING_SNAPSHOT_H
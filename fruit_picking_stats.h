@@ -0,0 +1,223 @@
+#ifndef FRUIT_PICKING_STATS_H
+#define FRUIT_PICKING_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+// Hot-path statistics: counts of the rule and sort work and latency
+// histograms of the main operations. They are compiled in only when
+// FRUIT_PICKING_STATS is defined, which must then hold in every translation
+// unit; without it the hooks expand to nothing, their arguments are not
+// evaluated and snapshot() reports zeros. Totals are process-wide relaxed
+// atomics, so work on any thread adds to the same numbers.
+
+namespace fruit_stats {
+
+#ifdef FRUIT_PICKING_STATS
+inline constexpr bool ENABLED = true;
+#else
+inline constexpr bool ENABLED = false;
+#endif
+
+enum class Counter : std::uint8_t {
+    WORM_SWEEPS,           // worm rule passes over a nonempty range
+    WORM_SWEPT_FRUITS,     // fruits those passes scanned
+    WORM_INFECTED_FRUITS,  // sweet healthy fruits they turned wormy
+    ROT_CONVERSIONS,       // healthy fruits the rot rule turned rotten
+    RANKING_SORTS,         // bulk sorts of ranking entries
+    RANKING_SORTED_PICKERS,
+    COUNT
+};
+
+enum class Operation : std::uint8_t {
+    PICKER_ADD,            // operator+=(const Fruit&)
+    PICKER_ADD_RANGE,
+    PICKER_TRANSFER,       // a single steal or give
+    PICKER_BULK_TRANSFER,  // steal_n and give_n
+    RANKING_BUILD,         // the bulk constructor
+    RANKING_SETTLE,        // placing pending insertions
+    RANKING_REMOVE,        // operator-=(const Picker&)
+    RANKING_MERGE,         // operator+= of rankings and merge_all
+    COUNT
+};
+
+inline constexpr std::size_t COUNTER_COUNT =
+    static_cast<std::size_t>(Counter::COUNT);
+inline constexpr std::size_t OPERATION_COUNT =
+    static_cast<std::size_t>(Operation::COUNT);
+
+// Lower-case names, e.g. for metric labels.
+constexpr std::string_view name(Counter counter);
+constexpr std::string_view name(Operation operation);
+
+// Latencies in power-of-two buckets: bucket b > 0 holds the calls that took
+// [2^(b-1), 2^b) ns, bucket 0 those under 1 ns, and the last one also
+// everything longer.
+struct LatencyHistogram {
+    static constexpr std::size_t BUCKETS = 48;
+
+    std::uint64_t calls = 0;
+    std::uint64_t total_ns = 0;
+    std::array<std::uint64_t, BUCKETS> buckets{};
+
+    double mean_ns() const;
+    // The upper end of the bucket holding quantile `q` of the calls, for
+    // 0 <= q <= 1; 0 when there were none.
+    std::uint64_t quantile_ns(double q) const;
+};
+
+struct Report {
+    std::array<std::uint64_t, COUNTER_COUNT> counters{};
+    std::array<LatencyHistogram, OPERATION_COUNT> latencies{};
+
+    std::uint64_t count(Counter counter) const {
+        return counters[static_cast<std::size_t>(counter)];
+    }
+    const LatencyHistogram& latency(Operation operation) const {
+        return latencies[static_cast<std::size_t>(operation)];
+    }
+};
+
+// The totals so far. Every value is read atomically, but not all of them
+// at the same instant.
+inline Report snapshot();
+inline void reset();
+
+namespace detail {
+
+struct Latency {
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<std::uint64_t> total_ns{0};
+    std::array<std::atomic<std::uint64_t>, LatencyHistogram::BUCKETS> buckets{};
+};
+
+struct Totals {
+    std::array<std::atomic<std::uint64_t>, COUNTER_COUNT> counters{};
+    std::array<Latency, OPERATION_COUNT> latencies;
+};
+
+inline constinit Totals totals;
+
+inline void add(Counter counter, std::uint64_t n) {
+    totals.counters[static_cast<std::size_t>(counter)].fetch_add(
+        n, std::memory_order_relaxed);
+}
+
+inline void record(Operation operation, std::uint64_t ns) {
+    Latency& latency = totals.latencies[static_cast<std::size_t>(operation)];
+    const std::size_t bucket = std::min<std::size_t>(
+        std::bit_width(ns), LatencyHistogram::BUCKETS - 1);
+    latency.calls.fetch_add(1, std::memory_order_relaxed);
+    latency.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    latency.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Records the time until the end of its scope.
+class ScopedTimer {
+   public:
+    explicit ScopedTimer(Operation operation)
+        : operation(operation), start(std::chrono::steady_clock::now()) {}
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer() {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        record(operation,
+               static_cast<std::uint64_t>(
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       elapsed)
+                       .count()));
+    }
+
+   private:
+    Operation operation;
+    std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace detail
+
+constexpr std::string_view name(Counter counter) {
+    constexpr std::string_view names[] = {
+        "worm_sweeps",     "worm_swept_fruits", "worm_infected_fruits",
+        "rot_conversions", "ranking_sorts",     "ranking_sorted_pickers"};
+    static_assert(std::size(names) == COUNTER_COUNT);
+    return names[static_cast<std::size_t>(counter)];
+}
+
+constexpr std::string_view name(Operation operation) {
+    constexpr std::string_view names[] = {
+        "picker_add",     "picker_add_range", "picker_transfer",
+        "picker_bulk_transfer", "ranking_build", "ranking_settle",
+        "ranking_remove", "ranking_merge"};
+    static_assert(std::size(names) == OPERATION_COUNT);
+    return names[static_cast<std::size_t>(operation)];
+}
+
+inline double LatencyHistogram::mean_ns() const {
+    return calls ? static_cast<double>(total_ns) / static_cast<double>(calls)
+                 : 0;
+}
+
+inline std::uint64_t LatencyHistogram::quantile_ns(double q) const {
+    if (calls == 0) return 0;
+    const auto rank =
+        static_cast<std::uint64_t>(q * static_cast<double>(calls));
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen > rank || seen == calls) return std::uint64_t(1) << b;
+    }
+    return std::uint64_t(1) << (BUCKETS - 1);
+}
+
+inline Report snapshot() {
+    Report report;
+    for (std::size_t c = 0; c < COUNTER_COUNT; ++c) {
+        report.counters[c] =
+            detail::totals.counters[c].load(std::memory_order_relaxed);
+    }
+    for (std::size_t o = 0; o < OPERATION_COUNT; ++o) {
+        const detail::Latency& from = detail::totals.latencies[o];
+        LatencyHistogram& to = report.latencies[o];
+        to.calls = from.calls.load(std::memory_order_relaxed);
+        to.total_ns = from.total_ns.load(std::memory_order_relaxed);
+        for (std::size_t b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            to.buckets[b] = from.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    return report;
+}
+
+inline void reset() {
+    for (auto& counter : detail::totals.counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (detail::Latency& latency : detail::totals.latencies) {
+        latency.calls.store(0, std::memory_order_relaxed);
+        latency.total_ns.store(0, std::memory_order_relaxed);
+        for (auto& bucket : latency.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+}  // namespace fruit_stats
+
+#ifdef FRUIT_PICKING_STATS
+#define FRUIT_STATS_ADD(counter, n) \
+    ::fruit_stats::detail::add(::fruit_stats::Counter::counter, (n))
+#define FRUIT_STATS_TIME(operation)                              \
+    const ::fruit_stats::detail::ScopedTimer fruit_stats_timer( \
+        ::fruit_stats::Operation::operation)
+#else
+#define FRUIT_STATS_ADD(counter, n) static_cast<void>(0)
+#define FRUIT_STATS_TIME(operation) static_cast<void>(0)
+#endif
+
+#endif  // FRUIT_PICKING_STATS_H
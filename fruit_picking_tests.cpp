@@ -1,19 +1,43 @@
 // Comprehensive tests for fruit_picking.h
 // Build: g++ -std=c++23 -O2 -Wall -Wextra -Werror -pedantic -fsanitize=address,undefined -fno-omit-frame-pointer fruit_picking_tests.cpp -o fruit_picking_tests
 
+// The tests run with the statistics hooks compiled in; the example and the
+// benchmarks build without them.
+#define FRUIT_PICKING_STATS
 #include "fruit_picking.h"
+#include "fruit_picking_events.h"
+#include "fruit_picking_format.h"
+#include "fruit_picking_parse.h"
+#include "fruit_picking_snapshot.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifdef NDEBUG
   #undef NDEBUG
 #endif
 
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <concepts>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <optional>
 #include <random>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -979,6 +1003,1706 @@ void test_compile_time_properties_with_static_assert() {
 } // namespace MaliciousTests
 
 
+// ======================== TESTS3 ========================
+
+// Global allocation counter, used to check that moves copy nothing. Kept out
+// of line so GCC does not pair the inlined malloc/free with new/delete.
+// Atomic because parallel merges allocate from worker threads.
+static std::atomic<std::size_t> allocation_count = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+  ++allocation_count;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  ++allocation_count;
+  return std::malloc(size ? size : 1);
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+// The default memory resource allocates through the aligned forms.
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t align) {
+  ++allocation_count;
+  const std::size_t alignment = static_cast<std::size_t>(align);
+  const std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+  if (void* p = std::aligned_alloc(alignment, rounded ? rounded : alignment)) return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+static void test_fruit_code_packing() {
+  static_assert(sizeof(Fruit) == 1);
+  static_assert(sizeof(FruitCode) == 1);
+  static_assert(YUMMY_ONE.code() == FruitCode::encode(Taste::SWEET, Size::LARGE, Quality::HEALTHY));
+  static_assert(Fruit{ROTTY_ONE.code()} == ROTTY_ONE);
+
+  // Every one of the 18 combinations round-trips and encodes uniquely.
+  std::vector<FruitCode::value_type> seen;
+  for (Taste t : {Taste::SWEET, Taste::SOUR}) {
+    for (Size s : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+      for (Quality q : {Quality::HEALTHY, Quality::ROTTEN, Quality::WORMY}) {
+        FruitCode c = FruitCode::encode(t, s, q);
+        assert(c.decode() == fruit_tuple_t(t, s, q));
+        assert(FruitCode::from_value(c.value()) == c);
+        FRUIT_ASSERTS(Fruit{c}, t, s, q);
+        assert(std::find(seen.begin(), seen.end(), c.value()) == seen.end());
+        seen.push_back(c.value());
+      }
+    }
+  }
+  assert(seen.size() == 18);
+  // Exactly those values are valid, whatever byte a reader finds.
+  for (std::size_t value = 0; value < 256; ++value) {
+    const auto code = FruitCode::try_from_value(value);
+    const bool encoded = std::find(seen.begin(), seen.end(), value) != seen.end();
+    assert(code.has_value() == encoded && (!code || code->value() == value));
+  }
+
+  FruitCode c = FruitCode::encode(Taste::SOUR, Size::MEDIUM, Quality::HEALTHY);
+  assert(c.with_quality(Quality::WORMY).decode() == fruit_tuple_t(Taste::SOUR, Size::MEDIUM, Quality::WORMY));
+}
+
+static void test_fruit_log_matches_deque() {
+  // Interleaved pushes and pops exercise both growth and front compaction.
+  std::mt19937 rng(2025);
+  std::uniform_int_distribution<int> code(0, 17);
+  FruitLog log;
+  std::deque<Fruit> reference;
+  for (int i = 0; i < 20000; ++i) {
+    if (!reference.empty() && rng() % 3 == 0) {
+      assert(log.front() == reference.front());
+      log.pop_front();
+      reference.pop_front();
+    } else {
+      int c = code(rng);
+      Fruit f{static_cast<Taste>(c / 9), static_cast<Size>(c / 3 % 3), static_cast<Quality>(c % 3)};
+      log.push_back(f);
+      reference.push_back(f);
+    }
+    assert(log.size() == reference.size());
+    if (!reference.empty()) assert(log.back() == reference.back());
+  }
+  assert(std::equal(log.begin(), log.end(), reference.begin(), reference.end()));
+
+  FruitLog copy{log};
+  assert(std::equal(copy.begin(), copy.end(), log.begin(), log.end()));
+  FruitLog moved{std::move(copy)};
+  assert(moved.size() == log.size() && copy.empty());
+  while (!moved.empty()) moved.pop_front();
+  moved.push_back(YUMMY_ONE);
+  assert(moved.size() == 1 && moved[0] == YUMMY_ONE);
+}
+
+static Fruit random_fruit(std::mt19937& rng) {
+  int c = static_cast<int>(rng() % 18);
+  return Fruit{static_cast<Taste>(c / 9), static_cast<Size>(c / 3 % 3), static_cast<Quality>(c % 3)};
+}
+
+static void test_infect_kernels_agree() {
+  std::mt19937 rng(7);
+  for (std::size_t n : {0u, 1u, 15u, 16u, 17u, 31u, 32u, 33u, 100u, 1000u}) {
+    std::vector<Fruit> input;
+    for (std::size_t i = 0; i < n; ++i) input.push_back(random_fruit(rng));
+
+    std::vector<Fruit> expected = input;
+    fruit_kernels::SizeCounts expected_count = fruit_kernels::infect_sweet_healthy_scalar(expected.data(), n);
+    for (const Fruit& f : expected) assert(!(f.taste() == Taste::SWEET && f.quality() == Quality::HEALTHY));
+    for (Size size : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+      auto converted = std::count_if(input.begin(), input.end(), [&](const Fruit& f) {
+        return f == Fruit{Taste::SWEET, size, Quality::HEALTHY};
+      });
+      assert(expected_count[static_cast<std::size_t>(size)] == static_cast<std::size_t>(converted));
+    }
+
+    std::vector<Fruit> dispatched = input;
+    assert(fruit_kernels::infect_sweet_healthy(dispatched) == expected_count);
+    assert(dispatched == expected);
+#ifdef FRUIT_PICKING_X86
+    std::vector<Fruit> sse2 = input;
+    assert(fruit_kernels::infect_sweet_healthy_sse2(sse2.data(), n) == expected_count);
+    assert(sse2 == expected);
+    if (fruit_kernels::avx2_supported()) {
+      std::vector<Fruit> avx2 = input;
+      assert(fruit_kernels::infect_sweet_healthy_avx2(avx2.data(), n) == expected_count);
+      assert(avx2 == expected);
+    }
+#endif
+  }
+
+  // A long worm-free streak followed by a worm goes through the vector path.
+  Picker p{"Streak"};
+  for (int i = 0; i < 1000; ++i) {
+    p += YUMMY_ONE;
+    p += Fruit{Taste::SOUR, Size::MEDIUM, Quality::HEALTHY};
+  }
+  p += Fruit{Taste::SOUR, Size::SMALL, Quality::WORMY};
+  PICKER_ASSERTS(p, 2001, 1000, 1001, 1000, 1000, 1, 1000, 0, 1001);
+}
+
+static void assert_same_picker_state(const Picker& a, const Picker& b) {
+  assert(a == b);
+  PICKER_ASSERTS(a, b.count_fruits(), b.count_taste(Taste::SWEET), b.count_taste(Taste::SOUR),
+                 b.count_size(Size::LARGE), b.count_size(Size::MEDIUM), b.count_size(Size::SMALL),
+                 b.count_quality(Quality::HEALTHY), b.count_quality(Quality::ROTTEN),
+                 b.count_quality(Quality::WORMY));
+}
+
+static void test_add_range_matches_one_by_one() {
+  std::mt19937 rng(99);
+  for (int round = 0; round < 200; ++round) {
+    Picker one_by_one{"Batch"}, batched{"Batch"};
+    for (int batch = 0; batch < 5; ++batch) {
+      std::vector<Fruit> fruits;
+      std::size_t n = rng() % 60;
+      for (std::size_t i = 0; i < n; ++i) {
+        // Skewed towards healthy fruits so rot and worm chains form.
+        Fruit f = random_fruit(rng);
+        if (rng() % 2) f = Fruit{f.taste(), f.size(), Quality::HEALTHY};
+        fruits.push_back(f);
+      }
+      for (const Fruit& f : fruits) one_by_one += f;
+      batched.add_range(fruits);
+      assert_same_picker_state(batched, one_by_one);
+
+      // The worm bookkeeping must carry over to later single additions.
+      Fruit extra = random_fruit(rng);
+      one_by_one += extra;
+      batched += extra;
+      assert_same_picker_state(batched, one_by_one);
+    }
+  }
+
+  // Non-contiguous ranges go through the same fused pass.
+  Picker a{"R"}, b{"R"};
+  std::vector<Fruit> fruits{YUMMY_ONE, ROTTY_ONE, YUMMY_ONE, Fruit{Taste::SWEET, Size::SMALL, Quality::WORMY}};
+  a.add_range(fruits | std::views::reverse);
+  for (auto it = fruits.rbegin(); it != fruits.rend(); ++it) b += *it;
+  assert_same_picker_state(a, b);
+
+  std::list<Fruit> listed{fruits.begin(), fruits.end()};
+  Picker c{"L"}, d{"L"};
+  c.add_range(listed);
+  c.add_range(std::span<const Fruit>{});
+  for (const Fruit& f : fruits) d += f;
+  assert_same_picker_state(c, d);
+}
+
+static void test_fruit_histogram_queries() {
+  std::mt19937 rng(5);
+  std::vector<Fruit> fruits;
+  FruitHistogram hist;
+  for (int i = 0; i < 500; ++i) {
+    fruits.push_back(random_fruit(rng));
+    hist.add(fruits.back().code());
+  }
+  for (int i = 0; i < 100; ++i) {
+    hist.remove(fruits.back().code());
+    fruits.pop_back();
+  }
+  FruitHistogram::Delta delta{};
+  Fruit moved = fruits.front();
+  --delta[moved.code().value()];
+  moved.go_rotten();
+  ++delta[moved.code().value()];
+  hist.apply(delta);
+  fruits.front() = moved;
+
+  using OT = std::optional<Taste>;
+  using OS = std::optional<Size>;
+  using OQ = std::optional<Quality>;
+  for (OT t : {OT{}, OT{Taste::SWEET}, OT{Taste::SOUR}}) {
+    for (OS s : {OS{}, OS{Size::LARGE}, OS{Size::MEDIUM}, OS{Size::SMALL}}) {
+      for (OQ q : {OQ{}, OQ{Quality::HEALTHY}, OQ{Quality::ROTTEN}, OQ{Quality::WORMY}}) {
+        auto expected = std::count_if(fruits.begin(), fruits.end(), [&](const Fruit& f) {
+          return (!t || f.taste() == *t) && (!s || f.size() == *s) && (!q || f.quality() == *q);
+        });
+        assert(hist.count(t, s, q) == static_cast<std::size_t>(expected));
+      }
+    }
+  }
+
+  Picker p{"Hist"};
+  for (int i = 0; i < 300; ++i) p += random_fruit(rng);
+  std::size_t sum = 0;
+  for (OT t : {OT{Taste::SWEET}, OT{Taste::SOUR}}) {
+    assert(p.count(t) == p.count_taste(*t));
+    for (OS s : {OS{Size::LARGE}, OS{Size::MEDIUM}, OS{Size::SMALL}}) {
+      for (OQ q : {OQ{Quality::HEALTHY}, OQ{Quality::ROTTEN}, OQ{Quality::WORMY}}) {
+        sum += p.count(t, s, q);
+      }
+    }
+  }
+  assert(sum == p.count_fruits() && p.count() == p.count_fruits());
+  assert(p.count(std::nullopt, Size::SMALL) == p.count_size(Size::SMALL));
+  assert(p.count(std::nullopt, std::nullopt, Quality::WORMY) == p.count_quality(Quality::WORMY));
+}
+
+// The ordering as specified: descending lexicographic over six counts.
+static std::strong_ordering reference_order(const Picker& a, const Picker& b) {
+  auto counts = [](const Picker& p) {
+    return std::array<std::size_t, 6>{p.count_quality(Quality::HEALTHY), p.count_taste(Taste::SWEET),
+                                      p.count_size(Size::LARGE), p.count_size(Size::MEDIUM),
+                                      p.count_size(Size::SMALL), p.count_fruits()};
+  };
+  return counts(b) <=> counts(a);
+}
+
+static void test_rank_key_matches_counts() {
+  std::mt19937 rng(11);
+  std::vector<Picker> pickers;
+  for (int i = 0; i < 60; ++i) {
+    Picker p{"K"};
+    std::size_t n = rng() % 6;
+    for (std::size_t j = 0; j < n; ++j) p += random_fruit(rng);
+    pickers.push_back(p);
+  }
+  // Steals exercise removals and quality changes on both sides.
+  for (int i = 0; i < 200; ++i) pickers[rng() % pickers.size()] += pickers[rng() % pickers.size()];
+  for (const Picker& a : pickers) {
+    for (const Picker& b : pickers) assert((a <=> b) == reference_order(a, b));
+  }
+
+  RankKey key;
+  key.add(YUMMY_ONE.code(), 3);
+  key.remove(YUMMY_ONE.code(), 2);
+  key.add(ROTTY_ONE.code());
+  assert((key.counts() == RankKey::Counts{1, 1, 1, 0, 1}));
+
+  // Counts past 32 bits do not spill into the criterion above them.
+  RankKey many_sweet, one_healthy;
+  many_sweet.add(Fruit{Taste::SWEET, Size::SMALL, Quality::ROTTEN}.code(), std::uint64_t(1) << 32);
+  one_healthy.add(Fruit{Taste::SOUR, Size::SMALL, Quality::HEALTHY}.code());
+  assert(many_sweet < one_healthy);
+  many_sweet.add(YUMMY_ONE.code());
+  assert(many_sweet > one_healthy);
+  assert((many_sweet.counts() == RankKey::Counts{1, (std::uint64_t(1) << 32) + 1, 1, 0, std::uint64_t(1) << 32}));
+}
+
+// What Ranking must behave like: a stably sorted vector.
+struct ReferenceRanking {
+  std::vector<Picker> pickers;
+  void add(const Picker& p) {
+    pickers.push_back(p);
+    std::stable_sort(pickers.begin(), pickers.end(), std::less<Picker>());
+  }
+  void remove(const Picker& p) {
+    auto it = std::find(pickers.begin(), pickers.end(), p);
+    if (it != pickers.end()) pickers.erase(it);
+  }
+  void merge(const ReferenceRanking& other) {
+    std::vector<Picker> merged;
+    std::merge(pickers.begin(), pickers.end(), other.pickers.begin(), other.pickers.end(),
+               std::back_inserter(merged), std::less<Picker>());
+    pickers = merged;
+  }
+};
+
+static void assert_same_ranking(const Ranking& r, const ReferenceRanking& ref) {
+  assert(r.count_pickers() == ref.pickers.size());
+  for (std::size_t i = 0; i < ref.pickers.size(); ++i) assert(r[i] == ref.pickers[i]);
+  std::ostringstream expected, actual;
+  for (std::size_t i = 0; i < ref.pickers.size(); ++i) expected << (i ? "\n" : "") << ref.pickers[i];
+  if (!ref.pickers.empty()) expected << "\n";
+  actual << r;
+  assert(actual.str() == expected.str());
+}
+
+static std::vector<Picker> random_pickers(std::mt19937& rng, std::size_t count) {
+  static const char* names[] = {"Ala", "Ola", "Ela"};
+  std::vector<Picker> pickers;
+  for (std::size_t i = 0; i < count; ++i) {
+    Picker p{names[rng() % 3]};
+    std::size_t n = rng() % 4;
+    for (std::size_t j = 0; j < n; ++j) p += random_fruit(rng);
+    pickers.push_back(p);
+  }
+  return pickers;
+}
+
+static void test_ranking_matches_reference_model() {
+  std::mt19937 rng(31337);
+  auto pool = random_pickers(rng, 40);
+
+  Ranking r;
+  ReferenceRanking ref;
+  for (int step = 0; step < 3000; ++step) {
+    const Picker& p = pool[rng() % pool.size()];
+    switch (rng() % 4) {
+      case 0:
+      case 1:
+        r += p;
+        ref.add(p);
+        break;
+      case 2:
+        r -= p;
+        ref.remove(p);
+        break;
+      case 3:
+        if (step % 50 == 0) {
+          Ranking other;
+          ReferenceRanking other_ref;
+          for (int i = 0; i < 5; ++i) {
+            const Picker& q = pool[rng() % pool.size()];
+            other += q;
+            other_ref.add(q);
+          }
+          r += other;
+          ref.merge(other_ref);
+        }
+        break;
+    }
+    if (step % 97 == 0) assert_same_ranking(r, ref);
+  }
+  assert_same_ranking(r, ref);
+
+  Ranking copy{r};
+  copy += copy;
+  ReferenceRanking doubled = ref;
+  doubled.merge(ref);
+  assert_same_ranking(copy, doubled);
+  assert_same_ranking(r, ref);
+
+  Ranking listed{pool[0], pool[1], pool[2], pool[3]};
+  ReferenceRanking listed_ref;
+  for (int i = 0; i < 4; ++i) listed_ref.add(pool[i]);
+  assert_same_ranking(listed, listed_ref);
+}
+
+static void test_fruit_log_copy_on_write() {
+  FruitLog log;
+  for (int i = 0; i < 100; ++i) log.push_back(YUMMY_ONE);
+
+  FruitLog copy{log};
+  assert(copy.is_shared() && log.is_shared());
+  assert(copy.begin() == log.begin());  // no fruits were copied
+
+  // Popping only moves the view and keeps sharing.
+  copy.pop_front();
+  assert(copy.is_shared() && copy.size() == 99 && log.size() == 100);
+
+  // Writing unshares, leaving the other copy untouched.
+  copy.mutable_fruits()[0].go_rotten();
+  assert(!copy.is_shared() && !log.is_shared());
+  assert(copy[0].quality() == Quality::ROTTEN && log[1].quality() == Quality::HEALTHY);
+
+  FruitLog appended{log};
+  appended.push_back(ROTTY_ONE);
+  assert(!log.is_shared() && log.size() == 100 && appended.size() == 101);
+
+  // Pickers and rankings share their fruit histories with the originals.
+  Picker p{"Shared"};
+  for (int i = 0; i < 1000; ++i) p += YUMMY_ONE;
+  Picker q{p};
+  Ranking r{p, q};
+  r += p;
+  assert(r[0] == p && r[1] == p && r[2] == p);
+  q += Fruit{Taste::SWEET, Size::LARGE, Quality::WORMY};
+  assert(q.count_quality(Quality::WORMY) == 1001 && p.count_quality(Quality::HEALTHY) == 1000);
+  assert(r[0] == p);
+  Picker thief{"Thief"};
+  thief += p;  // the donor's history stays shared until it is written to
+  assert(p.count_fruits() == 999 && r[0].count_fruits() == 1000);
+}
+
+static void test_move_operations_copy_nothing() {
+  // Long names do not fit the small-string buffer, so copying one allocates.
+  auto make_ranking = [](std::string_view prefix, int count) {
+    Ranking r;
+    for (int i = 0; i < count; ++i) {
+      Picker p{std::string(prefix) + "-a-rather-long-picker-name-" + std::to_string(i)};
+      for (int j = 0; j <= i % 7; ++j) p += (j % 2 ? ROTTY_ONE : YUMMY_ONE);
+      r += p;
+    }
+    return r;
+  };
+  const int n = 200;
+  Ranking a = make_ranking("A", n);
+  Ranking b = make_ranking("B", n);
+  Ranking c = b;
+
+  std::size_t before = allocation_count;
+  a += c;
+  std::size_t copying = allocation_count - before;
+  assert(copying >= static_cast<std::size_t>(n));  // one per copied name
+
+  before = allocation_count;
+  a += std::move(b);
+  std::size_t moving = allocation_count - before;
+  assert(moving < 10);  // only the merge's own bookkeeping vectors
+  assert(a.count_pickers() == 3 * n && b.count_pickers() == 0);
+  for (std::size_t i = 1; i < a.count_pickers(); ++i) assert(!(a[i] < a[i - 1]));
+
+  // Stealing from a temporary neither copies its history nor allocates.
+  Picker p{"Receiver"};
+  p += YUMMY_ONE;
+  Picker donor{"a-donor-with-a-name-too-long-for-sso"};
+  for (int i = 0; i < 1000; ++i) donor += ROTTY_ONE;
+  before = allocation_count;
+  p += std::move(donor);
+  assert(allocation_count == before);
+  PICKER_ASSERTS(p, 2, 1, 1, 1, 0, 1, 0, 2, 0);
+  assert(donor.count_fruits() == 999);
+
+  Picker giver{"Giver"};
+  giver += YUMMY_ONE;
+  giver += YUMMY_ONE;
+  giver -= Picker{"Temp"};
+  assert(giver.count_fruits() == 1);
+}
+
+static void test_fingerprints_follow_content() {
+  std::mt19937 rng(4242);
+
+  // The rolling updates agree with hashing the sequence from scratch.
+  std::deque<FruitCode> codes;
+  FruitFingerprint rolling;
+  for (int step = 0; step < 3000; ++step) {
+    FruitCode code = random_fruit(rng).code();
+    if (!codes.empty() && rng() % 3 == 0) {
+      rolling.pop_front(codes.front());
+      codes.pop_front();
+    } else if (!codes.empty() && rng() % 3 == 0) {
+      std::size_t at = rng() % codes.size();
+      rolling.replace(rolling.weight(at), codes[at], code);
+      codes[at] = code;
+    } else {
+      rolling.push_back(code);
+      codes.push_back(code);
+    }
+    FruitFingerprint fresh;
+    for (FruitCode c : codes) fresh.push_back(c);
+    assert(rolling == fresh);
+    if (!codes.empty()) assert(rolling.weight_from_back(1) == rolling.weight(codes.size() - 1));
+  }
+
+  // The word-at-a-time sweep weights match summing position weights.
+  for (int round = 0; round < 300; ++round) {
+    std::vector<Fruit> fruits;
+    for (std::size_t n = rng() % 70; n > 0; --n) fruits.push_back(rng() % 2 ? random_fruit(rng) : YUMMY_ONE);
+    std::size_t start = rng() % 1000;
+    std::uint64_t expected = 0;
+    for (std::size_t i = 0; i < fruits.size(); ++i) {
+      if (fruits[i].taste() == Taste::SWEET && fruits[i].quality() == Quality::HEALTHY) {
+        expected += rolling.weight(start + i);
+      }
+    }
+    assert(fruit_kernels::sweet_healthy_weight(fruits, rolling.weight(start)) == expected);
+  }
+
+  // A WORMY fruit interacts with no rule once it is gone, so a picker that
+  // gave one away holds what a picker that never had it holds.
+  const Fruit worm{Taste::SOUR, Size::LARGE, Quality::WORMY};
+  for (int round = 0; round < 200; ++round) {
+    Picker with{"Same"}, without{"Same"}, sink{"Sink"};
+    with += worm;
+    std::vector<Fruit> fruits;
+    std::size_t n = rng() % 80;
+    for (std::size_t i = 0; i < n; ++i) {
+      Fruit f = random_fruit(rng);
+      if (rng() % 2) f = Fruit{f.taste(), f.size(), Quality::HEALTHY};
+      fruits.push_back(f);
+    }
+    with.add_range(fruits);
+    for (const Fruit& f : fruits) without += f;
+    with -= sink;
+    assert(with == without && with.fingerprint() == without.fingerprint());
+
+    for (std::size_t i = 0; i < n / 2; ++i) {
+      sink += with;
+      without -= sink;
+    }
+    assert(with == without && with.fingerprint() == without.fingerprint());
+    assert(Picker{"Other"}.fingerprint() != Picker{"Same"}.fingerprint());
+  }
+
+  // Removal finds the right picker among many with equal rank keys.
+  Ranking r;
+  ReferenceRanking ref;
+  std::vector<Picker> tied;
+  for (int i = 0; i < 300; ++i) {
+    Picker p{"Tied-" + std::to_string(i % 100)};
+    p += (i % 2 ? YUMMY_ONE : Fruit{Taste::SWEET, Size::LARGE, Quality::HEALTHY});
+    tied.push_back(p);
+    r += p;
+    ref.add(p);
+  }
+  std::shuffle(tied.begin(), tied.end(), rng);
+  for (std::size_t i = 0; i < tied.size(); ++i) {
+    r -= tied[i];
+    ref.remove(tied[i]);
+    if (i % 37 == 0) assert_same_ranking(r, ref);
+  }
+  assert(r.count_pickers() == 0);
+}
+
+
+static void test_merge_all_matches_repeated_merges() {
+  std::mt19937 rng(2024);
+  auto make_sources = [&](std::size_t count, std::size_t max_size) {
+    std::vector<Ranking> sources(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      // Few distinct keys and per-source names, so ties across sources are
+      // common and any change to their order shows up.
+      for (std::size_t n = rng() % (max_size + 1); n > 0; --n) {
+        Picker p{"Orchard-" + std::to_string(i)};
+        for (std::size_t f = rng() % 3; f > 0; --f) p += random_fruit(rng);
+        sources[i] += p;
+      }
+    }
+    return sources;
+  };
+  auto assert_same_order = [](const Ranking& a, const Ranking& b) {
+    assert(a.count_pickers() == b.count_pickers());
+    for (std::size_t i = 0; i < a.count_pickers(); ++i) assert(a[i] == b[i]);
+  };
+
+  for (auto [count, max_size, threads] : {std::tuple<std::size_t, std::size_t, std::size_t>{0, 0, 0},
+                                          {1, 50, 0}, {7, 40, 3}, {256, 20, 0}, {64, 1100, 4}}) {
+    auto sources = make_sources(count, max_size);
+    Ranking repeated;
+    for (const Ranking& r : sources) repeated += r;
+
+    Ranking merged = Ranking::merge_all(sources, threads);
+    assert_same_order(merged, repeated);
+
+    Ranking moved = Ranking::merge_all(std::move(sources), threads);
+    assert_same_order(moved, repeated);
+    for (const Ranking& r : sources) assert(r.count_pickers() == 0);
+
+    // The result is a working ranking.
+    if (moved.count_pickers() > 0) {
+      Picker first = moved[0];
+      moved -= first;
+      assert(moved.count_pickers() == repeated.count_pickers() - 1);
+      moved += first;
+      assert(moved.count_pickers() == repeated.count_pickers());
+    }
+  }
+}
+
+static void test_bulk_construction_is_stable() {
+  std::mt19937 rng(77);
+  for (auto [count, threads] : {std::pair<std::size_t, std::size_t>{0, 0}, {1, 0}, {500, 0},
+                                {40000, 4}, {40000, 3}}) {
+    std::vector<Picker> pickers;
+    for (std::size_t i = 0; i < count; ++i) {
+      // Few distinct keys and many names, so stability is observable.
+      Picker p{"P" + std::to_string(i % 1000)};
+      for (std::size_t f = rng() % 3; f > 0; --f) p += random_fruit(rng);
+      // Some counts above 255 make the radix sort use more than low bytes.
+      if (i % 997 == 0) {
+        for (std::size_t f = rng() % 600; f > 0; --f) p += random_fruit(rng);
+      }
+      pickers.push_back(p);
+    }
+    Ranking one_by_one;
+    for (const Picker& p : pickers) one_by_one += p;
+    auto assert_same_order = [&](const Ranking& r) {
+      assert(r.count_pickers() == one_by_one.count_pickers());
+      for (std::size_t i = 0; i < r.count_pickers(); ++i) assert(r[i] == one_by_one[i]);
+    };
+
+    for (auto mode : {Ranking::BuildMode::RADIX, Ranking::BuildMode::COMPARISON}) {
+      assert_same_order(Ranking(pickers, threads, mode));
+      assert(pickers.size() == count);
+    }
+
+    std::list<Picker> listed(pickers.begin(), pickers.end());
+    assert_same_order(Ranking(listed, threads));
+
+    // A view over an lvalue copies even when passed as a temporary.
+    Ranking viewed(pickers | std::views::filter([](const Picker&) { return true; }), threads);
+    assert_same_order(viewed);
+    for (const Picker& p : pickers) assert(!p.get_name().empty());  // nothing was moved from
+
+    Ranking moved(std::move(pickers), threads);
+    assert_same_order(moved);
+
+    if (count > 0) {
+      Picker best = moved[0];
+      moved -= best;
+      assert(moved.count_pickers() == count - 1);
+    }
+  }
+
+  // Counts too wide to pack into 64 bits take the full-key radix path.
+  std::vector<Picker> wide;
+  for (int i = 0; i < 50; ++i) {
+    Picker p{"W" + std::to_string(i % 5)};
+    std::size_t per_size = i % 10 == 0 ? 5000 : rng() % 4;
+    for (Size size : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+      std::vector<Fruit> fruits(per_size, Fruit{Taste::SWEET, size, Quality::HEALTHY});
+      p.add_range(fruits);
+    }
+    wide.push_back(p);
+  }
+  Ranking wide_one_by_one;
+  for (const Picker& p : wide) wide_one_by_one += p;
+  for (auto mode : {Ranking::BuildMode::RADIX, Ranking::BuildMode::COMPARISON}) {
+    Ranking r(wide, 0, mode);
+    for (std::size_t i = 0; i < wide.size(); ++i) assert(r[i] == wide_one_by_one[i]);
+  }
+
+  Picker a{"A"}, b{"B"};
+  b += YUMMY_ONE;
+  Ranking listed{a, b, a};
+  assert(listed.count_pickers() == 3 && listed[0] == b && listed[2] == a);
+}
+
+static void test_top_k_matches_ranking_prefix() {
+  std::mt19937 rng(314);
+  auto pool = random_pickers(rng, 60);
+  for (std::size_t k : {0, 1, 3, 10, 100}) {
+    Ranking full;
+    TopKRanking podium(k);
+    for (int i = 0; i < 2000; ++i) {
+      const Picker& p = pool[rng() % pool.size()];
+      full += p;
+      if (i % 2) {
+        podium += p;
+      } else {
+        podium += Picker{p};
+      }
+      assert(podium.count_pickers() == std::min<std::size_t>(k, i + 1));
+    }
+
+    auto best = podium.top();
+    auto expected = full.top(k);
+    assert(best.size() == std::min(k, full.count_pickers()) && expected.size() == best.size());
+    for (std::size_t i = 0; i < best.size(); ++i) {
+      assert(best[i] == full[i] && expected[i] == full[i]);
+    }
+
+    std::ostringstream printed, reference;
+    printed << podium;
+    Ranking prefix(expected);
+    reference << prefix;
+    assert(printed.str() == reference.str());
+  }
+  assert(Ranking{}.top(5).empty());
+}
+
+static void test_lazy_inserts_match_eager_order() {
+  std::mt19937 rng(2718);
+  auto pool = random_pickers(rng, 50);
+  Ranking r;
+  ReferenceRanking ref;
+  // Bursts of every size, so reads settle both one node at a time into a
+  // large tree and by sorting a batch larger than the tree.
+  for (std::size_t burst : {1, 300, 2, 5, 1000, 3, 40, 0, 7}) {
+    for (std::size_t i = 0; i < burst; ++i) {
+      const Picker& p = pool[rng() % pool.size()];
+      r += p;
+      ref.add(p);
+    }
+    assert(r.count_pickers() == ref.pickers.size());
+    switch (burst % 4) {
+      case 0: {
+        const Picker& p = pool[rng() % pool.size()];
+        r -= p;
+        ref.remove(p);
+        break;
+      }
+      case 1: {
+        const Ranking copy{r};
+        assert_same_ranking(copy, ref);
+        break;
+      }
+      case 2: {
+        Ranking other;
+        ReferenceRanking other_ref;
+        for (int i = 0; i < 20; ++i) {
+          const Picker& q = pool[rng() % pool.size()];
+          other += q;
+          other_ref.add(q);
+        }
+        r += other;
+        ref.merge(other_ref);
+        assert_same_ranking(other, other_ref);
+        break;
+      }
+      case 3: {
+        Ranking moved{std::move(r)};
+        r = std::move(moved);
+        break;
+      }
+    }
+    assert_same_ranking(r, ref);
+  }
+
+  // Unsettled sources merge and copy like settled ones.
+  Ranking a, b;
+  for (int i = 0; i < 30; ++i) {
+    a += pool[i];
+    b += pool[i + 10];
+  }
+  Ranking both = Ranking::merge_all(std::vector<Ranking>{a, b});
+  a += b;
+  assert(both.count_pickers() == 60);
+  for (std::size_t i = 0; i < 60; ++i) assert(both[i] == a[i]);
+}
+
+static void test_concurrent_reads_settle_once() {
+  std::mt19937 rng(1414);
+  auto pool = random_pickers(rng, 50);
+  Ranking r, expected;
+  for (int round = 0; round < 3; ++round) {
+    // Few and many insertions, so readers race on both ways of settling.
+    for (std::size_t i = 0; i < (round == 1 ? 4 : 2000); ++i) {
+      const Picker& p = pool[rng() % pool.size()];
+      r += p;
+      expected += p;
+      expected[0];
+    }
+    const Ranking& shared = r;
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+      readers.emplace_back([&shared, t] {
+        if (t == 0) {
+          shared[shared.count_pickers() - 1];
+        } else if (t == 1) {
+          shared.top(3);
+        } else {
+          // Copies settle their source like any other reader.
+          Ranking copy;
+          copy = shared;
+          assert(copy.count_pickers() == shared.count_pickers());
+        }
+      });
+    }
+    for (auto& reader : readers) reader.join();
+    assert(r.count_pickers() == expected.count_pickers());
+    for (std::size_t i = 0; i < r.count_pickers(); ++i) {
+      assert(r[i] == expected[i]);
+    }
+  }
+}
+
+static void test_handles_track_updated_entries() {
+  // Pickers can tie without being equal, so the model tracks which entry is
+  // which: a stably sorted vector of (picker, entry id) pairs.
+  using Entry = std::pair<Picker, int>;
+  std::vector<Entry> model;
+  auto by_picker = [](const Entry& a, const Entry& b) { return a.first < b.first; };
+  auto model_add = [&](const Picker& p, int id) {
+    model.emplace_back(p, id);
+    std::stable_sort(model.begin(), model.end(), by_picker);
+  };
+  auto model_rank = [&](int id) {
+    for (std::size_t i = 0; i < model.size(); ++i) {
+      if (model[i].second == id) return i;
+    }
+    assert(false);
+    return model.size();
+  };
+
+  std::mt19937 rng(1618);
+  auto pool = random_pickers(rng, 40);
+  Ranking r;
+  std::vector<std::pair<Ranking::Handle, int>> live;
+  int next_id = 0;
+  for (int step = 0; step < 3000; ++step) {
+    const Picker& p = pool[rng() % pool.size()];
+    switch (rng() % 5) {
+      case 0:
+      case 1:
+        live.emplace_back(r.add(p), next_id);
+        model_add(p, next_id++);
+        break;
+      case 2:
+      case 3:
+        if (!live.empty()) {
+          auto [h, id] = live[rng() % live.size()];
+          model.erase(model.begin() + model_rank(id));
+          model_add(p, id);
+          r.update(h, p);
+          assert(r.at(h) == p);
+        }
+        break;
+      case 4:
+        if (!live.empty() && step % 3 == 0) {
+          std::size_t i = rng() % live.size();
+          model.erase(model.begin() + model_rank(live[i].second));
+          r.remove(live[i].first);
+          assert(!r.contains(live[i].first));
+          live.erase(live.begin() + i);
+        } else if (step % 40 == 0) {
+          // Merged entries tie after ours and get no handle here.
+          Ranking other;
+          for (int i = 0; i < 5; ++i) {
+            other.add(pool[i]);
+            model.emplace_back(pool[i], -1);
+          }
+          std::stable_sort(model.begin(), model.end(), by_picker);
+          r += other;
+        }
+        break;
+    }
+    if (step % 61 == 0) {
+      assert(r.count_pickers() == model.size());
+      for (std::size_t i = 0; i < model.size(); ++i) assert(r[i] == model[i].first);
+      for (auto [h, id] : live) assert(r.rank_of(h) == model_rank(id));
+    }
+  }
+  for (auto [h, id] : live) assert(r.rank_of(h) == model_rank(id));
+
+  // Copies share the handles; removed entries' handles go stale for good.
+  assert(!live.empty());
+  Ranking::Handle h = live.front().first;
+  Ranking copy{r};
+  assert(copy.contains(h) && copy.at(h) == r.at(h));
+  r.remove(h);
+  Ranking::Handle reused = r.add(pool[0]);
+  assert(r.contains(reused) && !r.contains(h) && copy.contains(h));
+  bool threw = false;
+  try {
+    r.update(h, pool[1]);
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  assert(threw && r.at(reused) == pool[0]);
+  assert(!r.contains(Ranking::Handle{}));
+
+  // A ranking emptied by a merge, a move or an assignment hands out ids
+  // again, but never revives the handles it gave out before.
+  Ranking donor;
+  Ranking::Handle donated = donor.add(pool[0]);
+  copy += std::move(donor);
+  Ranking::Handle fresh = donor.add(pool[1]);
+  assert(!donor.contains(donated) && donor.contains(fresh));
+  assert(!copy.contains(donated));
+  Ranking taker{std::move(donor)};
+  Ranking::Handle after_move = donor.add(pool[2]);
+  assert(taker.contains(fresh) && !donor.contains(fresh));
+  assert(!taker.contains(after_move) && donor.at(after_move) == pool[2]);
+  donor = taker;
+  assert(!donor.contains(after_move) && donor.contains(fresh));
+  std::vector<Ranking> sources(1);
+  Ranking::Handle merged = sources[0].add(pool[3]);
+  Ranking all = Ranking::merge_all(std::move(sources));
+  sources.resize(1);
+  sources[0].add(pool[4]);
+  assert(!all.contains(merged) && !sources[0].contains(merged));
+
+  // Looking up a handle settles pending insertions first, so the picker
+  // it returns outlives the next read.
+  Ranking unsettled;
+  Ranking::Handle first = unsettled.add(pool[0]);
+  for (const Picker& p : pool) unsettled += p;
+  const Picker& held = unsettled.at(first);
+  const Picker& best = unsettled[0];
+  assert(held == pool[0] && !(held < best));
+}
+
+static void test_bulk_transfers_match_single_steals() {
+  std::mt19937 rng(1729);
+  auto add_fruits = [&](Picker& a, Picker& b, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      Fruit f = random_fruit(rng);
+      if (rng() % 2) f = Fruit{f.taste(), f.size(), Quality::HEALTHY};
+      a += f;
+      b += f;
+    }
+  };
+  auto check = [](const Picker& a, const Picker& b) {
+    assert_same_picker_state(a, b);
+    assert(a.rank_key() == b.rank_key() && a.fingerprint() == b.fingerprint());
+  };
+
+  for (int round = 0; round < 100; ++round) {
+    Picker single_x{"X"}, single_y{"Y"}, bulk_x{"X"}, bulk_y{"Y"};
+    add_fruits(single_x, bulk_x, rng() % 80);
+    add_fruits(single_y, bulk_y, rng() % 20);
+    if (round % 4 == 0) {
+      // Copies share their storage until one of them writes.
+      single_y = single_x;
+      bulk_y = bulk_x;
+    }
+    for (int step = 0; step < 12; ++step) {
+      std::size_t n = rng() % 40;
+      switch (rng() % 5) {
+        case 0:
+          for (std::size_t i = 0; i < n; ++i) single_x += single_y;
+          bulk_x.steal_n(bulk_y, n);
+          break;
+        case 1:
+          for (std::size_t i = 0; i < n; ++i) single_x -= single_y;
+          bulk_x.give_n(bulk_y, n);
+          break;
+        case 2:
+          while (single_y.count_fruits() != 0) single_x += single_y;
+          bulk_x.steal_all(bulk_y);
+          break;
+        case 3:
+          while (single_x.count_fruits() != 0) single_x -= single_y;
+          bulk_x.give_all(bulk_y);
+          break;
+        case 4:
+          add_fruits(single_y, bulk_y, n);
+          break;
+      }
+      check(bulk_x, single_x);
+      check(bulk_y, single_y);
+
+      // The worm bookkeeping must carry over to later single additions.
+      Fruit worm{Taste::SOUR, Size::SMALL, Quality::WORMY};
+      if (step % 3 == 0) {
+        single_x += worm;
+        bulk_x += worm;
+        single_y += YUMMY_ONE;
+        bulk_y += YUMMY_ONE;
+        check(bulk_x, single_x);
+        check(bulk_y, single_y);
+      }
+    }
+  }
+
+  Picker alone{"Alone"};
+  alone += YUMMY_ONE;
+  alone.steal_n(alone, 5).give_all(alone);
+  assert(alone.count_fruits() == 1);
+}
+
+static void test_snapshots_round_trip() {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "fruit_picking_snapshot_test.bin").string();
+  auto save = [&](const auto& value) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    Snapshot::write(out, value);
+  };
+
+  std::mt19937 rng(4242);
+  Picker picker{"Zbieracz"};
+  for (int i = 0; i < 1000; ++i) picker += random_fruit(rng);
+  Picker sink{"Sink"};
+  sink.steal_n(picker, 37);  // a popped front and a shifted worm index
+  save(picker);
+  {
+    Snapshot snapshot(path);
+    assert(snapshot.kind() == Snapshot::Kind::PICKER && snapshot.count_pickers() == 1);
+    assert(snapshot.name(0) == "Zbieracz");
+    auto fruits = snapshot.fruits(0);
+    assert(fruits.size() == picker.count_fruits());
+    Picker loaded = snapshot.picker();
+    assert_same_picker_state(loaded, picker);
+    assert(loaded.rank_key() == picker.rank_key() && loaded.fingerprint() == picker.fingerprint());
+    // The worm bookkeeping carries over to later additions.
+    for (int i = 0; i < 200; ++i) {
+      Fruit f = random_fruit(rng);
+      loaded += f;
+      picker += f;
+    }
+    assert_same_picker_state(loaded, picker);
+  }
+
+  auto pool = random_pickers(rng, 300);
+  Ranking ranking;
+  for (const Picker& p : pool) ranking += p;
+  save(ranking);
+  Snapshot snapshot(path);
+  assert(snapshot.kind() == Snapshot::Kind::RANKING && snapshot.count_pickers() == pool.size());
+  Ranking loaded = snapshot.ranking();
+  std::ostringstream expected, actual;
+  expected << ranking;
+  actual << loaded;
+  assert(actual.str() == expected.str());
+  for (std::size_t i = 0; i < pool.size(); ++i) {
+    assert(loaded[i] == ranking[i] && snapshot.name(i) == ranking[i].get_name());
+  }
+  loaded -= pool[0];
+  loaded += pool[1];
+  ranking -= pool[0];
+  ranking += pool[1];
+  for (std::size_t i = 0; i < ranking.count_pickers(); ++i) assert(loaded[i] == ranking[i]);
+
+  Snapshot moved = std::move(snapshot);
+  assert(moved.count_pickers() == pool.size());
+  bool threw = false;
+  try {
+    moved.picker(pool.size());
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // Truncated or foreign files are rejected when opened or read.
+  auto rejects = [&](const std::string& bytes) {
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      out << bytes;
+    }
+    try {
+      Snapshot broken(path);
+      broken.ranking();
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  std::ostringstream whole(std::ios::binary);
+  Snapshot::write(whole, ranking);
+  const std::string bytes = whole.str();
+  assert(rejects(""));
+  assert(rejects(bytes.substr(0, bytes.size() / 2)));
+  assert(rejects("not a snapshot at all, just some text"));
+  assert(!rejects(bytes));
+  // A 56-byte file with one record: its directory lies inside the header,
+  // or right after it with no room left for a record header. What there
+  // is of the record reads as an empty picker.
+  auto forge = [&](std::uint64_t directory) {
+    std::string forged = bytes.substr(0, 56);
+    const std::uint64_t count = 1, offset = 32, none = 0;
+    const std::uint64_t no_worm = FruitLog::npos;
+    std::memcpy(forged.data() + 16, &count, sizeof count);
+    std::memcpy(forged.data() + 24, &directory, sizeof directory);
+    std::memcpy(forged.data() + 32, &none, sizeof none);
+    std::memcpy(forged.data() + 40, &no_worm, sizeof no_worm);
+    std::memcpy(forged.data() + 48, &offset, sizeof offset);
+    return forged;
+  };
+  assert(rejects(forge(48)));
+  assert(rejects(forge(24)));
+
+  // A first fruit that is no fruit code, or that the counters disagree
+  // with, and two fruits swapped behind the fingerprint's back.
+  std::ostringstream one(std::ios::binary);
+  Snapshot::write(one, picker);
+  const std::string picker_bytes = one.str();
+  const std::size_t first_fruit = picker_bytes.find("Zbieracz") + 8;
+  auto rejects_edit = [&](auto edit) {
+    {
+      std::string forged = picker_bytes;
+      edit(forged.data() + first_fruit);
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      out << forged;
+    }
+    Snapshot broken(path);
+    int threw = 0;
+    try {
+      broken.fruits(0);
+    } catch (const std::runtime_error&) {
+      ++threw;
+    }
+    try {
+      broken.picker();
+    } catch (const std::runtime_error&) {
+      ++threw;
+    }
+    return threw == 2;
+  };
+  auto rejects_fruit = [&](char code) {
+    return rejects_edit([code](char* fruits) { fruits[0] = code; });
+  };
+  const char stored = picker_bytes[first_fruit];
+  assert(rejects_fruit('\xff') && rejects_fruit('\x03'));
+  assert(rejects_fruit(static_cast<char>(stored ^ 0x10)));
+  assert(!rejects_fruit(stored));
+  std::size_t other = 1;
+  while (picker_bytes[first_fruit + other] == stored) ++other;
+  assert(rejects_edit([other](char* fruits) { std::swap(fruits[0], fruits[other]); }));
+  std::filesystem::remove(path);
+}
+
+static void test_event_ingestion_matches_single_operations() {
+  static const char* names[] = {"Ala", "Ola", "Ela", "Jan", "Ewa"};
+  std::map<std::string, Picker> reference;
+  for (const char* name : names) reference.emplace(name, Picker{name});
+
+  // Writes a log of random events, in runs so the ingestor batches them,
+  // and applies each event to the reference pickers one at a time.
+  std::mt19937 rng(777);
+  auto make_log = [&](std::size_t events) {
+    std::ostringstream out(std::ios::binary);
+    EventLogWriter writer(out);
+    std::vector<std::uint32_t> ids;
+    for (std::size_t i = 0; i < 5; ++i) ids.push_back(writer.intern(names[(i + events) % 5]));
+    std::size_t written = 0;
+    while (written < events) {
+      std::size_t a = rng() % 5, b = rng() % 5, run = 1 + rng() % 20;
+      Picker& x = reference.at(names[(a + events) % 5]);
+      Picker& y = reference.at(names[(b + events) % 5]);
+      int kind = rng() % 3;
+      for (std::size_t i = 0; i < run && written < events; ++i, ++written) {
+        if (kind == 0) {
+          Fruit f = random_fruit(rng);
+          writer.add(ids[a], f);
+          x += f;
+        } else if (kind == 1) {
+          writer.steal(ids[a], ids[b]);
+          x += y;
+        } else {
+          writer.give(ids[a], ids[b]);
+          x -= y;
+        }
+      }
+    }
+    return out.str();
+  };
+  auto as_bytes = [](const std::string& log) {
+    return std::span<const std::byte>(reinterpret_cast<const std::byte*>(log.data()), log.size());
+  };
+  auto check = [&](const EventIngestor& ingestor) {
+    assert(ingestor.count_pickers() == 5);
+    for (const auto& [name, picker] : reference) assert_same_picker_state(ingestor.picker(name), picker);
+  };
+
+  // Each log names the pickers in a different order, so ids differ.
+  std::vector<std::string> logs;
+  for (std::size_t events : {300000, 5000, 1}) logs.push_back(make_log(events));
+
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "fruit_picking_events_test.bin").string();
+  EventIngestor from_memory, from_stream, from_fd, from_file;
+  for (const std::string& log : logs) {
+    IngestStats stats = from_memory.ingest(as_bytes(log));
+    assert(stats.bytes == log.size() && stats.events > 0);
+    std::istringstream in(log, std::ios::binary);
+    assert(from_stream.ingest(in).events == stats.events);
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      out << log;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    assert(from_fd.ingest(fd).events == stats.events);
+    ::close(fd);
+    assert(from_file.ingest_file(path).events == stats.events);
+  }
+  std::filesystem::remove(path);
+  for (const EventIngestor* ingestor : {&from_memory, &from_stream, &from_fd, &from_file}) check(*ingestor);
+
+  // Malformed logs throw once the events before the bad one are applied.
+  std::string log;
+  {
+    std::ostringstream out(std::ios::binary);
+    EventLogWriter writer(out);
+    std::uint32_t ala = writer.intern("Ala");
+    writer.add(ala, YUMMY_ONE);
+    writer.add(ala, YUMMY_ONE);
+    log = out.str();
+  }
+  auto rejects = [&](const std::string& bytes) {
+    EventIngestor ingestor;
+    try {
+      ingestor.ingest(as_bytes(bytes));
+    } catch (const std::runtime_error&) {
+      return ingestor.count_pickers() == 0 || ingestor.picker("Ala").count_fruits() == 2;
+    }
+    return false;
+  };
+  assert(rejects(""));
+  assert(rejects(log.substr(0, 10)));
+  assert(rejects(log + "\x02"));          // cut inside an event
+  assert(rejects(log + "\x09"));          // unknown tag
+  assert(rejects(log + std::string("\x03\x00\x00\x00\x00\x07\x00\x00\x00", 9)));  // unnamed id
+  assert(rejects(log + std::string("\x02\x00\x00\x00\x00\x03", 6)));  // invalid fruit
+  assert(!rejects(log));
+}
+
+static void test_fast_text_matches_streams() {
+  for (Taste t : {Taste::SWEET, Taste::SOUR}) {
+    for (Size s : {Size::LARGE, Size::MEDIUM, Size::SMALL}) {
+      for (Quality q : {Quality::HEALTHY, Quality::ROTTEN, Quality::WORMY}) {
+        std::ostringstream os;
+        os << Fruit{t, s, q};
+        assert(fruit_text::render(Fruit{t, s, q}) == os.str());
+      }
+    }
+  }
+
+  std::mt19937 rng(2020);
+  auto pool = random_pickers(rng, 500);
+  Picker long_one{"Długi zbieracz"};
+  for (int i = 0; i < 30000; ++i) long_one += random_fruit(rng);
+  pool.push_back(long_one);
+  pool.push_back(Picker{});
+
+  auto streamed = [](const auto& value) {
+    std::ostringstream os;
+    os << value;
+    return os.str();
+  };
+  for (const Picker& p : {pool[0], pool[1], long_one, Picker{}}) {
+    std::string text = "prefix";
+    append_text(text, p);
+    assert(text == "prefix" + streamed(p) && text_size(p) == streamed(p).size());
+  }
+
+  Ranking ranking(pool);
+  const std::string expected = streamed(ranking);
+  std::string text;
+  append_text(text, ranking);
+  assert(text == expected && text_size(ranking) == expected.size());
+  std::string empty;
+  append_text(empty, Ranking{});
+  assert(empty.empty() && text_size(Ranking{}) == 0);
+
+  // Through a descriptor, with the text many times the buffer's size.
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "fruit_picking_text_test.txt").string();
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  assert(fd >= 0);
+  {
+    TextWriter writer(fd);
+    writer << ranking << "--\n" << pool[2];
+    writer.flush();
+  }
+  ::close(fd);
+  std::ifstream in(path, std::ios::binary);
+  std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  assert(written == expected + "--\n" + streamed(pool[2]));
+  std::filesystem::remove(path);
+}
+
+static void test_parse_round_trips_text() {
+  auto streamed = [](const auto& value) {
+    std::ostringstream os;
+    os << value;
+    return os.str();
+  };
+  std::mt19937 rng(2121);
+  auto pool = random_pickers(rng, 300);
+  Picker worms{"Kto: robaki"};
+  for (int i = 0; i < 5000; ++i) worms += random_fruit(rng);
+  Picker thief{"Złodziej"};
+  for (int i = 0; i < 50; ++i) thief += pool[static_cast<std::size_t>(i)];
+  pool.push_back(worms);
+  pool.push_back(thief);
+  pool.push_back(Picker{});
+
+  // Parsed pickers carry on exactly like the printed ones.
+  for (const Picker& p : pool) {
+    Picker parsed = parse_picker(streamed(p));
+    assert_same_picker_state(parsed, p);
+    assert(parsed.fingerprint() == p.fingerprint());
+    Picker original = p;
+    for (int i = 0; i < 20; ++i) {
+      const Fruit fruit = random_fruit(rng);
+      parsed += fruit;
+      original += fruit;
+    }
+    assert_same_picker_state(parsed, original);
+  }
+
+  Ranking ranking(pool);
+  const std::string text = streamed(ranking);
+  auto pickers = parse_pickers(text);
+  assert(pickers.size() == ranking.count_pickers());
+  for (std::size_t i = 0; i < pickers.size(); ++i) {
+    assert_same_picker_state(pickers[i], ranking[i]);
+  }
+  assert(streamed(parse_ranking(text, 1)) == text);
+  assert(streamed(parse_ranking(text)) == text);
+  assert(parse_pickers("").empty());
+  assert(streamed(parse_ranking("")).empty());
+
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "fruit_picking_parse_test.txt").string();
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << ranking;
+  }
+  assert(streamed(load_ranking_text(path)) == text);
+  std::filesystem::remove(path);
+
+  auto rejects = [](std::string_view bad) {
+    try {
+      parse_pickers(bad);
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  assert(rejects("Ala"));
+  assert(rejects(":"));
+  assert(rejects("Ala:\n\t[słodki duży zdrowy"));
+  assert(rejects("Ala:\n\t[kwaśny duży zdrowy]x"));
+  assert(rejects("Ala:\n\t[gorzki duży zdrowy]"));
+  assert(rejects("Ala:\n\t[słodki duży zdrowy]\n\tOla:"));
+  assert(rejects("Ala:\n\nOla:"));
+  assert(!rejects("Ala:\n\t[kwaśny mały robaczywy]\nOla:"));
+  bool threw = false;
+  try {
+    parse_picker(text);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+static void test_stats_count_hot_path_work() {
+  using fruit_stats::Counter;
+  using fruit_stats::Operation;
+  static_assert(fruit_stats::ENABLED);
+  const Fruit worm{Taste::SOUR, Size::SMALL, Quality::WORMY};
+  const Fruit rotten{Taste::SOUR, Size::MEDIUM, Quality::ROTTEN};
+  const Fruit healthy{Taste::SOUR, Size::MEDIUM, Quality::HEALTHY};
+
+  fruit_stats::reset();
+  Picker one_by_one{"Stats"};
+  for (int i = 0; i < 10; ++i) one_by_one += YUMMY_ONE;
+  one_by_one += worm;     // sweeps the 10 sweet healthy fruits
+  one_by_one += worm;     // nothing left to sweep
+  one_by_one += healthy;
+  one_by_one += rotten;   // rots the healthy one before it
+  one_by_one += healthy;  // rots itself
+  auto report = fruit_stats::snapshot();
+  assert(report.count(Counter::WORM_SWEEPS) == 1);
+  assert(report.count(Counter::WORM_SWEPT_FRUITS) == 10);
+  assert(report.count(Counter::WORM_INFECTED_FRUITS) == 10);
+  assert(report.count(Counter::ROT_CONVERSIONS) == 2);
+  assert(report.latency(Operation::PICKER_ADD).calls == 15);
+  assert(report.latency(Operation::PICKER_ADD_RANGE).calls == 0);
+
+  // The batched path counts the same work.
+  fruit_stats::reset();
+  Picker batched{"Stats"};
+  std::vector<Fruit> fruits(10, YUMMY_ONE);
+  for (Fruit f : {worm, worm, healthy, rotten, healthy}) fruits.push_back(f);
+  batched.add_range(fruits);
+  report = fruit_stats::snapshot();
+  assert(report.count(Counter::WORM_SWEEPS) == 1);
+  assert(report.count(Counter::WORM_SWEPT_FRUITS) == 11);
+  assert(report.count(Counter::WORM_INFECTED_FRUITS) == 10);
+  assert(report.count(Counter::ROT_CONVERSIONS) == 2);
+  assert(report.latency(Operation::PICKER_ADD_RANGE).calls == 1);
+  assert(report.latency(Operation::PICKER_ADD).calls == 0);
+  assert_same_picker_state(batched, one_by_one);
+
+  fruit_stats::reset();
+  Picker thief{"Thief"};
+  thief += batched;
+  thief.steal_n(batched, 3);
+  batched -= thief;
+  report = fruit_stats::snapshot();
+  assert(report.latency(Operation::PICKER_TRANSFER).calls == 2);
+  assert(report.latency(Operation::PICKER_BULK_TRANSFER).calls == 1);
+
+  fruit_stats::reset();
+  std::mt19937 rng(2323);
+  auto pool = random_pickers(rng, 200);
+  Ranking ranking(pool, 2);
+  for (const Picker& p : pool) ranking += p;
+  ranking -= pool[0];
+  Ranking merged = Ranking::merge_all(std::vector<Ranking>{ranking, ranking});
+  report = fruit_stats::snapshot();
+  assert(report.count(Counter::RANKING_SORTS) == 2);
+  assert(report.count(Counter::RANKING_SORTED_PICKERS) == 200 + 400);
+  assert(report.latency(Operation::RANKING_BUILD).calls == 1);
+  assert(report.latency(Operation::RANKING_SETTLE).calls == 1);
+  assert(report.latency(Operation::RANKING_REMOVE).calls == 1);
+  assert(report.latency(Operation::RANKING_MERGE).calls == 1);
+  assert(merged.count_pickers() == 2 * 399);
+
+  const auto& settle = report.latency(Operation::RANKING_SETTLE);
+  std::uint64_t bucketed = 0;
+  for (std::uint64_t n : settle.buckets) bucketed += n;
+  assert(bucketed == 1 && settle.mean_ns() == double(settle.total_ns));
+  assert(settle.quantile_ns(0.5) >= settle.total_ns &&
+         settle.quantile_ns(0.5) <= 2 * settle.total_ns + 1);
+
+  fruit_stats::LatencyHistogram histogram;
+  histogram.calls = 4;
+  histogram.buckets[0] = 1;
+  histogram.buckets[3] = 2;
+  histogram.buckets[10] = 1;
+  assert(histogram.quantile_ns(0) == 1 && histogram.quantile_ns(0.5) == 8 &&
+         histogram.quantile_ns(0.99) == 1024 && histogram.quantile_ns(1) == 1024);
+  assert(fruit_stats::name(Counter::ROT_CONVERSIONS) == "rot_conversions");
+  assert(fruit_stats::name(Operation::RANKING_MERGE) == "ranking_merge");
+
+  fruit_stats::reset();
+  assert(fruit_stats::snapshot().count(Counter::WORM_SWEEPS) == 0);
+}
+
+// Forwards to the default resource and keeps a balance, so memory returned
+// to the wrong resource, or never returned, shows up.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  std::size_t allocations = 0;
+  std::ptrdiff_t live_bytes = 0;
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++allocations;
+    live_bytes += static_cast<std::ptrdiff_t>(bytes);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+    live_bytes -= static_cast<std::ptrdiff_t>(bytes);
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+static void test_fruit_log_small_buffer() {
+  CountingResource heap;
+  const std::size_t small = FruitLog::INLINE_CAPACITY;
+  FruitLog log{&heap};
+  for (std::size_t i = 0; i < small; ++i) log.push_back(i % 2 ? ROTTY_ONE : YUMMY_ONE);
+  for (int i = 0; i < 1000; ++i) {
+    log.pop_front();
+    log.push_back(i % 2 ? ROTTY_ONE : YUMMY_ONE);
+  }
+  assert(log.size() == small && heap.allocations == 0);
+  for (std::size_t i = 0; i < small; ++i) assert(log[i] == (i % 2 ? ROTTY_ONE : YUMMY_ONE));
+
+  // Inline copies are independent from the start.
+  FruitLog copy{log};
+  FruitLog elsewhere{log, std::pmr::get_default_resource()};
+  assert(!copy.is_shared() && !log.is_shared() && copy.begin() != log.begin());
+  copy.mutable_fruits()[0].go_rotten();
+  assert(copy[0].quality() == Quality::ROTTEN);
+  assert(log[0].quality() == Quality::HEALTHY && elsewhere[0].quality() == Quality::HEALTHY);
+  FruitLog moved{std::move(copy)};
+  assert(moved.size() == small && copy.empty() && moved[0].quality() == Quality::ROTTEN);
+  copy = std::move(moved);
+  assert(copy.size() == small && moved.empty() && heap.allocations == 0);
+
+  // One more fruit spills to the heap; a copy shares the block until it
+  // has popped back down to what fits inline and writes.
+  log.push_back(YUMMY_ONE);
+  assert(heap.allocations == 1 && log.size() == small + 1 && log.back() == YUMMY_ONE);
+  FruitLog shared{log};
+  assert(shared.is_shared() && shared.begin() == log.begin());
+  shared.pop_front(2);
+  shared.mutable_fruits()[0].go_rotten();
+  assert(!shared.is_shared() && !log.is_shared() && heap.allocations == 1);
+  assert(shared.size() == small - 1 && shared[0].quality() == Quality::ROTTEN);
+  assert(log[2].quality() == Quality::HEALTHY);
+
+  // Appending to a shared copy moves it inline the same way.
+  FruitLog appended{log};
+  appended.pop_front(3);
+  appended.push_back(ROTTY_ONE);
+  appended.append(std::span(&YUMMY_ONE, 1));
+  assert(!appended.is_shared() && !log.is_shared() && heap.allocations == 1);
+  assert(appended.size() == small && appended.back() == YUMMY_ONE);
+  assert(appended[small - 2] == ROTTY_ONE && log.size() == small + 1);
+
+  // A picker with a short name and few fruits allocates nothing.
+  CountingResource arena;
+  Picker p{"Small", &arena}, reference{"Small"};
+  for (const Fruit& fruit : {YUMMY_ONE, ROTTY_ONE, YUMMY_ONE, Fruit{Taste::SOUR, Size::SMALL, Quality::WORMY},
+                             YUMMY_ONE, YUMMY_ONE, ROTTY_ONE, ROTTY_ONE}) {
+    p += fruit;
+    reference += fruit;
+  }
+  assert(p == reference && p.count_fruits() == reference.count_fruits());
+  Ranking r{&arena};
+  r += p;
+  r += reference;
+  Picker thief{"Thief", &arena};
+  thief.steal_n(p, 3);
+  assert(thief.count_fruits() == 3 && p.count_fruits() == 5);
+  const std::size_t before = arena.allocations;
+  Picker copied{p};
+  Picker assigned{&arena};
+  assigned = reference;
+  assert(arena.allocations == before && copied == p);
+  assert(std::ranges::equal(assigned.fruits(), reference.fruits()));
+}
+
+static void test_allocators_propagate() {
+  CountingResource arena;
+  std::pmr::memory_resource* heap = std::pmr::get_default_resource();
+  auto all_in = [](const Ranking& ranking, std::pmr::memory_resource* resource) {
+    bool all = ranking.get_allocator().resource() == resource;
+    ranking.for_each([&](const Picker& p) { all = all && p.get_allocator().resource() == resource; });
+    return all;
+  };
+  auto assert_same = [](const Ranking& a, const Ranking& b) {
+    std::ostringstream a_text, b_text;
+    a_text << a;
+    b_text << b;
+    assert(a.count_pickers() == b.count_pickers() && a_text.str() == b_text.str());
+  };
+  {
+    Picker p{"a-picker-name-longer-than-the-small-buffer", &arena};
+    for (int i = 0; i < 100; ++i) p += (i % 3 ? YUMMY_ONE : ROTTY_ONE);
+    assert(p.get_allocator().resource() == &arena && arena.allocations >= 2);
+    assert(Picker{&arena}.get_name() == "Anonim");
+    // The name's string type depends on the allocator; callers see a view.
+    static_assert(std::same_as<decltype(p.get_name()), std::string_view>);
+
+    // Copies keep the source's resource unless given another.
+    Picker same{p};
+    Picker elsewhere{p, heap};
+    assert(same.get_allocator().resource() == &arena && same == p);
+    assert(elsewhere.get_allocator().resource() == heap && elsewhere == p);
+    elsewhere += YUMMY_ONE;  // writes to its own copy only
+    assert(elsewhere.count_fruits() == 101 && p.count_fruits() == 100);
+
+    // Assignment keeps the target's resource.
+    Picker assigned;
+    assigned = p;
+    assert(assigned.get_allocator().resource() == heap && assigned == p);
+    Picker moved_into;
+    moved_into = Picker{same};
+    assert(moved_into.get_allocator().resource() == heap && moved_into == p);
+    Picker moved{std::move(same)};
+    assert(moved.get_allocator().resource() == &arena && moved == p);
+    Picker rebound{std::move(moved), heap};
+    assert(rebound.get_allocator().resource() == heap && rebound == p);
+    Picker parsed = Picker::from_history("Parsed", p.fruits(), &arena);
+    assert(parsed.get_allocator().resource() == &arena && parsed.fruits().size() == 100);
+
+    // Transfers between resources move the fruits' values only.
+    Picker thief{"Thief"};
+    thief += p;
+    thief.steal_n(p, 10);
+    p.give_n(thief, 5);
+    assert(thief.count_fruits() == 16 && p.count_fruits() == 84);
+
+    std::mt19937 rng(2424);
+    auto pool = random_pickers(rng, 300);
+    pool.push_back(elsewhere);
+    Ranking in_arena{&arena};
+    for (const Picker& q : pool) in_arena += q;
+    in_arena += p;
+    in_arena -= pool[1];
+    auto handle = in_arena.add(pool[2]);
+    in_arena.update(handle, elsewhere);
+    assert(all_in(in_arena, &arena));
+    Ranking on_heap(pool);
+    assert(all_in(on_heap, heap));
+
+    Ranking built(pool, 2, Ranking::BuildMode::RADIX, &arena);
+    assert(all_in(built, &arena));
+    Ranking built_from_moved(std::vector<Picker>(pool), 0, Ranking::BuildMode::COMPARISON, &arena);
+    assert(all_in(built_from_moved, &arena));
+    assert_same(built, built_from_moved);
+    assert_same(built, on_heap);
+
+    // Results of operator+ and merges live where their first operand does.
+    assert(all_in(in_arena + on_heap, &arena) && all_in(on_heap + in_arena, heap));
+    Ranking merged = in_arena;
+    merged += on_heap;
+    merged += Ranking(on_heap);
+    assert(all_in(merged, &arena));
+    assert(all_in(Ranking::merge_all(std::vector<Ranking>{in_arena, on_heap}), &arena));
+    const Ranking parts[] = {on_heap, in_arena};
+    Ranking merged_all = Ranking::merge_all(parts);
+    assert(all_in(merged_all, heap));
+    assert_same(merged_all, on_heap + in_arena);
+
+    Ranking copy{in_arena};
+    Ranking copy_on_heap{in_arena, heap};
+    assert(all_in(copy, &arena) && all_in(copy_on_heap, heap));
+    assert_same(copy, in_arena);
+    assert_same(copy_on_heap, in_arena);
+    Ranking assigned_ranking;
+    assigned_ranking = in_arena;
+    assert(all_in(assigned_ranking, heap));
+    Ranking moved_ranking;
+    moved_ranking = std::move(copy);
+    assert(all_in(moved_ranking, heap));
+    assert_same(moved_ranking, in_arena);
+    Ranking stolen{std::move(copy_on_heap), heap};
+    assert(all_in(stolen, heap) && copy_on_heap.count_pickers() == 0);
+
+    // Moving keeps pending insertions unsettled and in the source's
+    // resource, so neither the move nor later insertions use the default.
+    Ranking unsettled{&arena};
+    for (int i = 0; i < 50; ++i) unsettled += p;
+    std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    Ranking moved_unsettled{std::move(unsettled)};
+    for (int i = 0; i < 50; ++i) moved_unsettled += p;
+    std::pmr::set_default_resource(heap);
+    assert(moved_unsettled.count_pickers() == 100 && unsettled.count_pickers() == 0);
+    assert(all_in(moved_unsettled, &arena));
+  }
+  assert(arena.live_bytes == 0);
+
+  // A whole round in a monotonic arena, released in one go.
+  std::pmr::monotonic_buffer_resource round;
+  {
+    Ranking ranking{&round};
+    std::mt19937 rng(25);
+    for (const Picker& q : random_pickers(rng, 1000)) ranking += q;
+    ranking = ranking + ranking;
+    assert(ranking.count_pickers() == 2000 && all_in(ranking, &round));
+  }
+  round.release();
+}
+
+// Like most memory resources, not safe to share between threads; counts the
+// calls made from any thread but the one that created it.
+class OneThreadResource : public std::pmr::memory_resource {
+ public:
+  std::atomic<std::size_t> foreign_calls = 0;
+
+ private:
+  const std::thread::id owner = std::this_thread::get_id();
+
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    if (std::this_thread::get_id() != owner) ++foreign_calls;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+    if (std::this_thread::get_id() != owner) ++foreign_calls;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+static void test_parallel_work_allocates_on_calling_thread() {
+  OneThreadResource resource;
+  std::mt19937 rng(11011);
+  // Enough pickers for four merge workers, with names and histories too
+  // long to copy without allocating.
+  std::vector<Picker> pool;
+  for (int i = 0; i < 40000; ++i) {
+    Picker p{"A picker with a long name " + std::to_string(i)};
+    for (std::size_t n = 17 + rng() % 8; n > 0; --n) p += random_fruit(rng);
+    pool.push_back(std::move(p));
+  }
+  const std::vector<Picker> first(pool.begin(), pool.begin() + 20000);
+  const std::vector<Picker> second(pool.begin() + 20000, pool.end());
+  const Ranking in_resource(first, 1, Ranking::BuildMode::RADIX, &resource);
+  const Ranking on_heap(second, 1);
+  Ranking expected = in_resource;
+  expected += on_heap;
+
+  const Ranking parts[] = {in_resource, on_heap};
+  Ranking merged = Ranking::merge_all(parts, 4);
+  Ranking moved = Ranking::merge_all(std::vector<Ranking>{in_resource, on_heap}, 4);
+  Ranking moved_to_heap = Ranking::merge_all(std::vector<Ranking>{on_heap, in_resource}, 4);
+  assert(resource.foreign_calls == 0);
+  assert(merged.get_allocator().resource() == &resource);
+  assert(moved.get_allocator().resource() == &resource);
+  std::ostringstream expected_text, merged_text, moved_text;
+  expected_text << expected;
+  merged_text << merged;
+  moved_text << moved;
+  assert(merged_text.str() == expected_text.str() && moved_text.str() == expected_text.str());
+  assert(moved_to_heap.count_pickers() == pool.size());
+
+  // Loading a snapshot allocates from the default resource, so it stays on
+  // this thread too while that resource is not the heap.
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "fruit_picking_resource_test.bin").string();
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    Snapshot::write(out, merged);
+  }
+  Snapshot snapshot(path);
+  std::pmr::memory_resource* heap = std::pmr::set_default_resource(&resource);
+  Ranking loaded = snapshot.ranking(4);
+  std::pmr::set_default_resource(heap);
+  assert(resource.foreign_calls == 0 && loaded.get_allocator().resource() == &resource);
+  std::ostringstream loaded_text;
+  loaded_text << loaded;
+  assert(loaded_text.str() == expected_text.str());
+  std::filesystem::remove(path);
+}
+
 int main() {
   
 // ======================== TESTS1 ========================
@@ -1005,5 +2729,33 @@ int main() {
   
 //   Custom tests
   MaliciousTests::test_picker_comparison();
+
+// ======================== TESTS3 ========================
+  test_fruit_code_packing();
+  test_fruit_log_matches_deque();
+  test_infect_kernels_agree();
+  test_add_range_matches_one_by_one();
+  test_fruit_histogram_queries();
+  test_rank_key_matches_counts();
+  test_ranking_matches_reference_model();
+  test_fruit_log_copy_on_write();
+  test_move_operations_copy_nothing();
+  test_fingerprints_follow_content();
+  test_merge_all_matches_repeated_merges();
+  test_bulk_construction_is_stable();
+  test_top_k_matches_ranking_prefix();
+  test_lazy_inserts_match_eager_order();
+  test_concurrent_reads_settle_once();
+  test_handles_track_updated_entries();
+  test_bulk_transfers_match_single_steals();
+  test_snapshots_round_trip();
+  test_event_ingestion_matches_single_operations();
+  test_fast_text_matches_streams();
+  test_parse_round_trips_text();
+  test_stats_count_hot_path_work();
+  test_allocators_propagate();
+  test_fruit_log_small_buffer();
+  test_parallel_work_allocates_on_calling_thread();
+  cout << "ALL TESTS3 PASSED!\n";
   return 0;
 }